@@ -2,6 +2,11 @@
 
 get_filename_component(SELF_DIR "${CMAKE_CURRENT_LIST_FILE}" PATH)
 
+if(NOT WIN32)
+	include(CMakeFindDependencyMacro)
+	find_dependency(Threads)
+endif()
+
 if(EXISTS ${SELF_DIR}/akali-target.cmake)
 	include(${SELF_DIR}/akali-target.cmake)
 endif()
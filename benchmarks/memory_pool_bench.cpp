@@ -0,0 +1,127 @@
+// Compares the thread safe pool flavours with MemoryPool behind a mutex and with new/delete.
+//
+// Every thread repeatedly allocates a batch of objects and frees it again, half of the batches
+// are freed by the neighbour thread to exercise cross-thread frees.
+//
+// usage: memory_pool_bench [max_threads] [rounds]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "akali/memory_pool.hpp"
+#include "akali/concurrent_memory_pool.hpp"
+#include "akali/lockfree_memory_pool.hpp"
+
+namespace {
+struct Object {
+  char payload[48];
+};
+
+const size_t kBatch = 64;
+
+struct NewDelete {
+  Object* Allocate() { return new Object; }
+  void Deallocate(Object* p) { delete p; }
+};
+
+struct MutexPool {
+  Object* Allocate() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pool.allocate();
+  }
+  void Deallocate(Object* p) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pool.deallocate(p);
+  }
+  std::mutex mutex;
+  akali::MemoryPool<Object, 65536> pool;
+};
+
+struct Magazines {
+  Object* Allocate() { return pool.allocate(); }
+  void Deallocate(Object* p) { pool.deallocate(p); }
+  akali::ConcurrentMemoryPool<Object> pool;
+};
+
+struct LockFree {
+  Object* Allocate() { return pool.allocate(); }
+  void Deallocate(Object* p) { pool.deallocate(p); }
+  akali::LockFreeMemoryPool<Object> pool;
+};
+
+// Hands a batch to the neighbour thread.
+struct Mailbox {
+  std::mutex mutex;
+  std::vector<Object*> objects;
+};
+
+template <class Pool>
+double Run(size_t threads, size_t rounds) {
+  Pool pool;
+  std::vector<Mailbox> mailboxes(threads);
+  std::vector<std::thread> workers;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t t = 0; t < threads; t++) {
+    workers.emplace_back([&pool, &mailboxes, t, threads, rounds]() {
+      std::vector<Object*> batch(kBatch);
+      std::vector<Object*> inbox;
+      for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < kBatch; i++) {
+          batch[i] = pool.Allocate();
+          batch[i]->payload[0] = static_cast<char>(i);
+        }
+
+        if (r % 2 == 0 && threads > 1) {
+          Mailbox& next = mailboxes[(t + 1) % threads];
+          std::lock_guard<std::mutex> lock(next.mutex);
+          next.objects.insert(next.objects.end(), batch.begin(), batch.end());
+        }
+        else {
+          for (size_t i = 0; i < kBatch; i++)
+            pool.Deallocate(batch[i]);
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mailboxes[t].mutex);
+          inbox.swap(mailboxes[t].objects);
+        }
+        for (Object* p : inbox)
+          pool.Deallocate(p);
+        inbox.clear();
+      }
+    });
+  }
+  for (std::thread& w : workers)
+    w.join();
+
+  for (Mailbox& m : mailboxes) {
+    for (Object* p : m.objects)
+      pool.Deallocate(p);
+  }
+
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  // One operation is an allocate/deallocate pair.
+  return static_cast<double>(threads * rounds * kBatch) / seconds / 1e6;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t max_threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 8;
+  size_t rounds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 20000;
+
+  printf("%-8s %14s %14s %14s %14s   (M alloc/free pairs per second)\n", "threads", "new/delete",
+         "mutex", "magazine", "lock-free");
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    double a = Run<NewDelete>(threads, rounds);
+    double b = Run<MutexPool>(threads, rounds);
+    double c = Run<Magazines>(threads, rounds);
+    double d = Run<LockFree>(threads, rounds);
+    printf("%-8zu %14.2f %14.2f %14.2f %14.2f\n", threads, a, b, c, d);
+  }
+  return 0;
+}
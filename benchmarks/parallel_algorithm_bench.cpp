@@ -0,0 +1,68 @@
+// Compares akali::parallel algorithms with their serial std counterparts.
+//
+// For every size, from 1M elements up to max_millions (10x steps), times std::sort against
+// parallel::sort on random ints, and std::accumulate/std::partial_sum against parallel::reduce/
+// parallel::inclusive_scan. Every parallel result is checked against the serial one.
+//
+// usage: parallel_algorithm_bench [threads] [max_millions]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+#include "akali/parallel_algorithm.hpp"
+#include "akali/thread_pool.hpp"
+
+namespace {
+template <class F>
+double Seconds(F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Report(const char* name, size_t n, double serial, double parallel, bool same) {
+  printf("%-16s %6zuM %12.1f %12.1f %8.2fx %s\n", name, n / 1000000, serial * 1e3, parallel * 1e3,
+         serial / parallel, same ? "" : "MISMATCH");
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+  size_t max_millions = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100;
+  // the calling thread takes part too
+  akali::ThreadPool pool(threads > 0 ? threads - 1 : 0);
+
+  printf("%zu threads\n", threads);
+  printf("%-16s %7s %12s %12s %9s\n", "algorithm", "n", "std ms", "parallel ms", "speedup");
+  for (size_t millions = 1; millions <= max_millions; millions *= 10) {
+    size_t n = millions * 1000000;
+    std::vector<int> input(n);
+    std::mt19937 rng(42);
+    for (int& x : input)
+      x = static_cast<int>(rng());
+
+    std::vector<int> a = input;
+    std::vector<int> b = input;
+    double serial = Seconds([&]() { std::sort(a.begin(), a.end()); });
+    double parallel = Seconds([&]() { akali::parallel::sort(pool, b.begin(), b.end()); });
+    Report("sort", n, serial, parallel, a == b);
+
+    long long sum = 0;
+    long long parallel_sum = 0;
+    serial = Seconds([&]() { sum = std::accumulate(input.begin(), input.end(), 0LL); });
+    parallel = Seconds(
+        [&]() { parallel_sum = akali::parallel::reduce(pool, input.begin(), input.end(), 0LL); });
+    Report("reduce", n, serial, parallel, sum == parallel_sum);
+
+    serial = Seconds([&]() { std::partial_sum(input.begin(), input.end(), a.begin()); });
+    parallel = Seconds(
+        [&]() { akali::parallel::inclusive_scan(pool, input.begin(), input.end(), b.begin()); });
+    Report("inclusive_scan", n, serial, parallel, a == b);
+  }
+  return 0;
+}
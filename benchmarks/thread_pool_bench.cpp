@@ -0,0 +1,68 @@
+// Compares the ThreadPool modes on tiny tasks.
+//
+// flat: the main thread enqueues every task, which always goes through the injection queue.
+// tree: every task enqueues two children until the given depth, so almost all tasks are
+// enqueued by workers.
+//
+// usage: thread_pool_bench [max_threads] [depth]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <vector>
+#include "akali/thread_pool.hpp"
+
+namespace {
+std::atomic<size_t> done(0);
+
+void Tree(akali::ThreadPool* pool, int depth) {
+  done.fetch_add(1, std::memory_order_relaxed);
+  if (depth == 0)
+    return;
+  pool->post(Tree, pool, depth - 1);
+  pool->post(Tree, pool, depth - 1);
+}
+
+double RunFlat(size_t threads, akali::ThreadPoolMode mode, size_t tasks) {
+  auto start = std::chrono::steady_clock::now();
+  {
+    akali::ThreadPool pool(threads, mode);
+    for (size_t i = 0; i < tasks; i++)
+      pool.post([]() { done.fetch_add(1, std::memory_order_relaxed); });
+  }
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return tasks / seconds / 1e6;
+}
+
+double RunTree(size_t threads, akali::ThreadPoolMode mode, int depth) {
+  done = 0;
+  auto start = std::chrono::steady_clock::now();
+  {
+    akali::ThreadPool pool(threads, mode);
+    pool.post(Tree, &pool, depth);
+  }
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return done / seconds / 1e6;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t max_threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 8;
+  int depth = argc > 2 ? atoi(argv[2]) : 18;
+  size_t flat_tasks = (size_t(1) << (depth + 1)) - 1;
+
+  printf("%-8s %14s %14s %14s %14s   (M tasks per second)\n", "threads", "flat shared",
+         "flat stealing", "tree shared", "tree stealing");
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    double a = RunFlat(threads, akali::ThreadPoolMode::kSharedQueue, flat_tasks);
+    double b = RunFlat(threads, akali::ThreadPoolMode::kWorkStealing, flat_tasks);
+    double c = RunTree(threads, akali::ThreadPoolMode::kSharedQueue, depth);
+    double d = RunTree(threads, akali::ThreadPoolMode::kWorkStealing, depth);
+    printf("%-8zu %14.2f %14.2f %14.2f %14.2f\n", threads, a, b, c, d);
+  }
+  return 0;
+}
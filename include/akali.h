@@ -31,6 +31,11 @@
 #include "akali/ini.h"
 #include "akali/md5.h"
 #include "akali/memory_pool.hpp"
+#include "akali/concurrent_memory_pool.hpp"
+#include "akali/lockfree_memory_pool.hpp"
+#include "akali/size_class_pool.hpp"
+#include "akali/arena.hpp"
+#include "akali/object_pool.hpp"
 #include "akali/os_ver.h"
 #include "akali/pc_info.h"
 #include "akali/process_util.h"
@@ -63,8 +68,22 @@
 #include "akali/stack_walker.h"
 #include "akali/directory_monitor.h"
 #include "akali/trace.h"
+#include "akali/cpu_topology.h"
+#include "akali/location.h"
 #include "akali/thread.hpp"
+#include "akali/watchdog.hpp"
+#include "akali/task.hpp"
+#include "akali/cancellation_token.hpp"
+#include "akali/future.hpp"
+#include "akali/work_stealing_deque.hpp"
 #include "akali/thread_pool.hpp"
+#include "akali/task_graph.hpp"
+#include "akali/parallel_algorithm.hpp"
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include "akali/coroutine.hpp"
+#endif
+#endif
 
 #if defined(__cplusplus) && __cplusplus >= 201703L && defined(__has_include)
 #if __has_include(<filesystem>)
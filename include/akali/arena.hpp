@@ -0,0 +1,274 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_ARENA_H_
+#define AKALI_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "akali/akali_export.h"
+#include "akali/constructormagic.h"
+
+#if defined(_MSVC_LANG) && _MSVC_LANG >= 201703L || __cplusplus >= 201703L
+#if defined(__has_include)
+#if __has_include(<memory_resource>)
+#define AKALI_ARENA_HAS_PMR
+#include <memory_resource>
+#endif
+#endif
+#endif
+
+/*
+Arena is a monotonic (bump pointer) allocator for objects that all die together, e.g. everything
+allocated while handling one request.
+
+Memory is carved from a chain of blocks. Individual allocations are never freed: Mark() records
+the current position and Rewind() drops everything allocated after it, Reset() drops everything.
+Blocks released this way are kept for reuse, Release() returns them to the system. All of these
+run in O(blocks). Destructors are not run by the arena, use it for trivially destructible objects
+or for objects whose destructor only releases memory obtained from the same arena.
+
+ArenaAllocator<T> adapts an arena to the C++11 allocator interface, its deallocate is a no-op.
+With C++17 ArenaMemoryResource exposes the same arena as a std::pmr::memory_resource.
+
+This is **NOT** thread safe.
+*/
+
+namespace akali {
+class Arena {
+ public:
+  struct Marker {
+    void* block;
+    char* cur;
+  };
+
+  explicit Arena(size_t block_size = 4096)
+      : block_size_(block_size < kMinBlockSize ? kMinBlockSize : block_size)
+      , head_(nullptr)
+      , spare_(nullptr)
+      , cur_(nullptr)
+      , end_(nullptr)
+      , bytes_allocated_(0) {}
+
+  ~Arena() { Release(); }
+
+  void* Allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    if (cur_ == nullptr || Padding(cur_, align) + size > static_cast<size_t>(end_ - cur_))
+      NewBlock(size + align);
+    char* p = cur_ + Padding(cur_, align);
+    cur_ = p + size;
+    bytes_allocated_ += size;
+    return p;
+  }
+
+  template <class T, class... Args>
+  T* New(Args&&... args) {
+    return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  template <class T>
+  T* NewArray(size_t n) {
+    return static_cast<T*>(Allocate(sizeof(T) * n, alignof(T)));
+  }
+
+  Marker Mark() const {
+    Marker m = {head_, cur_};
+    return m;
+  }
+
+  // Drops everything allocated after `marker` was taken.
+  void Rewind(const Marker& marker) {
+    while (head_ != nullptr && head_ != marker.block)
+      PopBlock();
+    if (head_ != nullptr) {
+      cur_ = marker.cur;
+      end_ = reinterpret_cast<char*>(head_) + head_->size;
+    }
+    else {
+      cur_ = nullptr;
+      end_ = nullptr;
+    }
+  }
+
+  // Drops everything, the blocks are kept for reuse.
+  void Reset() {
+    Marker m = {nullptr, nullptr};
+    Rewind(m);
+    bytes_allocated_ = 0;
+  }
+
+  // Drops everything and returns all blocks to the system.
+  void Release() {
+    Reset();
+    while (spare_) {
+      Block* next = spare_->prev;
+      operator delete(reinterpret_cast<void*>(spare_));
+      spare_ = next;
+    }
+  }
+
+  // Bytes handed out since construction or the last Reset(), Rewind() does not lower it.
+  size_t BytesAllocated() const { return bytes_allocated_; }
+  size_t BlockSize() const { return block_size_; }
+
+ private:
+  struct Block {
+    Block* prev;
+    size_t size;
+  };
+
+  enum : size_t { kMinBlockSize = 256 };
+
+  static size_t Padding(char* p, size_t align) {
+    return (align - reinterpret_cast<uintptr_t>(p) % align) % align;
+  }
+
+  void NewBlock(size_t min_size) {
+    Block* block = nullptr;
+    if (spare_ != nullptr && spare_->size >= sizeof(Block) + min_size) {
+      block = spare_;
+      spare_ = spare_->prev;
+    }
+    else {
+      size_t size = sizeof(Block) + min_size;
+      if (size < block_size_)
+        size = block_size_;
+      block = reinterpret_cast<Block*>(operator new(size));
+      block->size = size;
+    }
+    block->prev = head_;
+    head_ = block;
+    cur_ = reinterpret_cast<char*>(block) + sizeof(Block);
+    end_ = reinterpret_cast<char*>(block) + block->size;
+  }
+
+  void PopBlock() {
+    Block* block = head_;
+    head_ = block->prev;
+    if (block->size == block_size_) {
+      block->prev = spare_;
+      spare_ = block;
+    }
+    else {
+      // Oversized blocks are not worth keeping around.
+      operator delete(reinterpret_cast<void*>(block));
+    }
+  }
+
+  size_t block_size_;
+  Block* head_;
+  Block* spare_;
+  char* cur_;
+  char* end_;
+  size_t bytes_allocated_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// Rewinds the arena to where it was when the scope was entered.
+class ArenaScope {
+ public:
+  explicit ArenaScope(Arena* arena) : arena_(arena), marker_(arena->Mark()) {}
+  ~ArenaScope() { arena_->Rewind(marker_); }
+
+ private:
+  Arena* arena_;
+  Arena::Marker marker_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(ArenaScope);
+};
+
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef T& reference;
+  typedef const T* const_pointer;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  template <typename U>
+  struct rebind {
+    typedef ArenaAllocator<U> other;
+  };
+
+  explicit ArenaAllocator(Arena* arena) noexcept : arena_(arena) {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena_(other.arena()) {}
+
+  pointer allocate(size_type n, const void* = 0) {
+    return static_cast<pointer>(arena_->Allocate(n * sizeof(value_type), alignof(value_type)));
+  }
+
+  // Memory is reclaimed by Arena::Rewind/Reset.
+  void deallocate(pointer, size_type) {}
+
+  size_type max_size() const noexcept { return size_type(-1) / sizeof(value_type); }
+
+  template <class U, class... Args>
+  void construct(U* p, Args&&... args) {
+    new (p) U(std::forward<Args>(args)...);
+  }
+  template <class U>
+  void destroy(U* p) {
+    p->~U();
+  }
+
+  Arena* arena() const noexcept { return arena_; }
+
+ private:
+  Arena* arena_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) noexcept {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) noexcept {
+  return !(a == b);
+}
+
+#ifdef AKALI_ARENA_HAS_PMR
+class ArenaMemoryResource : public std::pmr::memory_resource {
+ public:
+  explicit ArenaMemoryResource(Arena* arena) noexcept : arena_(arena) {}
+
+  Arena* arena() const noexcept { return arena_; }
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    return arena_->Allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void*, size_t, size_t) override {}
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  Arena* arena_;
+};
+#endif
+}  // namespace akali
+#endif  // AKALI_ARENA_H_
@@ -0,0 +1,72 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_CANCELLATION_TOKEN_H_
+#define AKALI_CANCELLATION_TOKEN_H_
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+/*
+Cooperative cancellation. A CancellationSource hands out CancellationTokens, cancel() flips all of
+them at once. Nothing is interrupted: a long task polls is_cancelled() (a single load) at points
+where it can stop, or calls throw_if_cancelled() to unwind with OperationCancelled.
+
+Tokens are cheap to copy and stay valid after their source is gone. A default constructed token is
+never cancelled.
+*/
+
+namespace akali {
+class OperationCancelled : public std::runtime_error {
+ public:
+  OperationCancelled() : std::runtime_error("operation cancelled") {}
+};
+
+class CancellationToken {
+ public:
+  CancellationToken() {}
+
+  bool is_cancelled() const { return state_ && state_->load(std::memory_order_acquire); }
+
+  void throw_if_cancelled() const {
+    if (is_cancelled())
+      throw OperationCancelled();
+  }
+
+ private:
+  friend class CancellationSource;
+
+  explicit CancellationToken(std::shared_ptr<std::atomic<bool>> state)
+      : state_(std::move(state)) {}
+
+  std::shared_ptr<std::atomic<bool>> state_;
+};
+
+class CancellationSource {
+ public:
+  CancellationSource() : state_(std::make_shared<std::atomic<bool>>(false)) {}
+
+  CancellationToken token() const { return CancellationToken(state_); }
+
+  void cancel() { state_->store(true, std::memory_order_release); }
+
+  bool is_cancelled() const { return state_->load(std::memory_order_acquire); }
+
+ private:
+  std::shared_ptr<std::atomic<bool>> state_;
+};
+}  // namespace akali
+#endif  // AKALI_CANCELLATION_TOKEN_H_
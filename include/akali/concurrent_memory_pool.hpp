@@ -0,0 +1,522 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_CONCURRENT_MEMORY_POOL_H_
+#define AKALI_CONCURRENT_MEMORY_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "akali/akali_export.h"
+
+/*
+ConcurrentMemoryPool is the thread safe sibling of MemoryPool, it can be shared by any number
+of threads and used as a std allocator in the same way.
+
+Every thread keeps a small cache of two magazines (arrays of up to `MagazineSize` free slots).
+allocate/deallocate only touch the calling thread's magazines, the shared depot is locked once
+per `MagazineSize` operations to exchange a full magazine for an empty one (or the reverse), or
+to carve a fresh batch of slots out of a block.
+
+All slots of a pool are interchangeable, so an object may be freed on any thread: its slot
+lands in that thread's magazine and flows back through the depot. Cached slots of a thread are
+returned to the depot when the thread exits or calls FlushThreadCache().
+
+Blocks are only released when the pool is destroyed. Moving a pool moves its blocks and thread
+caches along, a copy is a new empty pool.
+*/
+
+namespace akali {
+template <typename T, size_t BlockSize = 65536, size_t MagazineSize = 64>
+class ConcurrentMemoryPool {
+ public:
+  /* Member types */
+  typedef T value_type;
+  typedef T* pointer;
+  typedef T& reference;
+  typedef const T* const_pointer;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef std::false_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  template <typename U>
+  struct rebind {
+    typedef ConcurrentMemoryPool<U, BlockSize, MagazineSize> other;
+  };
+
+  /* Member functions */
+  ConcurrentMemoryPool();
+  ConcurrentMemoryPool(const ConcurrentMemoryPool& memoryPool);
+  ConcurrentMemoryPool(ConcurrentMemoryPool&& memoryPool) noexcept;
+  template <class U>
+  ConcurrentMemoryPool(const ConcurrentMemoryPool<U, BlockSize, MagazineSize>& memoryPool);
+
+  ~ConcurrentMemoryPool() noexcept;
+
+  ConcurrentMemoryPool& operator=(const ConcurrentMemoryPool& memoryPool) = delete;
+  ConcurrentMemoryPool& operator=(ConcurrentMemoryPool&& memoryPool) noexcept;
+
+  pointer address(reference x) const noexcept { return &x; }
+  const_pointer address(const_reference x) const noexcept { return &x; }
+
+  // Serves one object per call, other counts are forwarded to the global heap. hint is ignored.
+  pointer allocate(size_type n = 1, const_pointer hint = 0);
+  void deallocate(pointer p, size_type n = 1);
+
+  size_type max_size() const noexcept;
+
+  template <class U, class... Args>
+  void construct(U* p, Args&&... args) {
+    new (p) U(std::forward<Args>(args)...);
+  }
+  template <class U>
+  void destroy(U* p) {
+    p->~U();
+  }
+
+  template <class... Args>
+  pointer newElement(Args&&... args);
+  void deleteElement(pointer p);
+
+  // Returns the slots cached by the calling thread to the shared depot.
+  void FlushThreadCache();
+
+ private:
+  union Slot_ {
+    typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type element;
+    Slot_* next;
+  };
+
+  typedef char* data_pointer;
+  typedef Slot_ slot_type;
+  typedef Slot_* slot_pointer;
+
+  struct Magazine {
+    size_type count;
+    slot_pointer slots[MagazineSize];
+    Magazine* next;
+  };
+
+  // State shared by the pool and the thread caches, it outlives the pool while a thread is
+  // flushing its cache back.
+  struct Depot {
+    Depot();
+    ~Depot();
+
+    Magazine* NewMagazine();
+    void PushMagazine(Magazine* m);
+    void Fill(Magazine* m);
+    void AllocateBlock();
+
+    std::mutex mutex;
+    Magazine* full;   // magazines holding at least one slot
+    Magazine* empty;  // magazines holding no slot
+    std::vector<Magazine*> magazines;
+    slot_pointer loose;  // single slots released without a thread cache
+    slot_pointer current_block;
+    slot_pointer current_slot;
+    slot_pointer last_slot;
+  };
+
+  struct ThreadCache {
+    uint64_t pool_id;
+    std::weak_ptr<Depot> depot;
+    Magazine* loaded;
+    Magazine* previous;
+  };
+
+  struct ThreadCacheList {
+    ~ThreadCacheList();
+    std::vector<ThreadCache*> caches;
+  };
+
+  // Fast path lookup of the cache used last by this thread, ids are never reused.
+  struct LastCache {
+    uint64_t pool_id;
+    ThreadCache* cache;
+    bool exited;
+  };
+
+  static LastCache& Last() {
+    static thread_local LastCache last = {0, nullptr, false};
+    return last;
+  }
+  static ThreadCacheList& Caches() {
+    static thread_local ThreadCacheList caches;
+    return caches;
+  }
+  static uint64_t NextPoolId() {
+    static std::atomic<uint64_t> next_id(1);
+    return next_id.fetch_add(1, std::memory_order_relaxed);
+  }
+  static void ReleaseCache(ThreadCache* cache);
+
+  ThreadCache* LocalCache();
+  ThreadCache* FindOrCreateCache();
+
+  uint64_t id_;
+  std::shared_ptr<Depot> depot_;
+
+  static_assert(BlockSize >= 2 * sizeof(slot_type), "BlockSize too small.");
+  static_assert(MagazineSize > 0, "MagazineSize too small.");
+};
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::Depot::Depot()
+    : full(nullptr)
+    , empty(nullptr)
+    , loose(nullptr)
+    , current_block(nullptr)
+    , current_slot(nullptr)
+    , last_slot(nullptr) {}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::Depot::~Depot() {
+  for (Magazine* m : magazines)
+    delete m;
+
+  slot_pointer curr = current_block;
+  while (curr != nullptr) {
+    slot_pointer prev = curr->next;
+    operator delete(reinterpret_cast<void*>(curr));
+    curr = prev;
+  }
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+typename ConcurrentMemoryPool<T, BlockSize, MagazineSize>::Magazine*
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::Depot::NewMagazine() {
+  Magazine* m = empty;
+  if (m) {
+    empty = m->next;
+  }
+  else {
+    m = new Magazine;
+    m->count = 0;
+    magazines.push_back(m);
+  }
+  m->next = nullptr;
+  return m;
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+void ConcurrentMemoryPool<T, BlockSize, MagazineSize>::Depot::PushMagazine(Magazine* m) {
+  if (m->count > 0) {
+    m->next = full;
+    full = m;
+  }
+  else {
+    m->next = empty;
+    empty = m;
+  }
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+void ConcurrentMemoryPool<T, BlockSize, MagazineSize>::Depot::AllocateBlock() {
+  data_pointer new_block = reinterpret_cast<data_pointer>(operator new(BlockSize));
+  reinterpret_cast<slot_pointer>(new_block)->next = current_block;
+  current_block = reinterpret_cast<slot_pointer>(new_block);
+
+  data_pointer body = new_block + sizeof(slot_pointer);
+  uintptr_t addr = reinterpret_cast<uintptr_t>(body);
+  size_type body_padding = (alignof(slot_type) - addr) % alignof(slot_type);
+  current_slot = reinterpret_cast<slot_pointer>(body + body_padding);
+  last_slot = reinterpret_cast<slot_pointer>(new_block + BlockSize - sizeof(slot_type) + 1);
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+void ConcurrentMemoryPool<T, BlockSize, MagazineSize>::Depot::Fill(Magazine* m) {
+  // Loose slots first, then a whole batch from the bump pointer.
+  while (loose && m->count < MagazineSize) {
+    m->slots[m->count++] = loose;
+    loose = loose->next;
+  }
+  while (m->count < MagazineSize) {
+    if (current_slot >= last_slot)
+      AllocateBlock();
+    m->slots[m->count++] = current_slot++;
+  }
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::ThreadCacheList::~ThreadCacheList() {
+  LastCache& last = Last();
+  last.pool_id = 0;
+  last.cache = nullptr;
+  last.exited = true;
+
+  for (ThreadCache* cache : caches)
+    ReleaseCache(cache);
+  caches.clear();
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+void ConcurrentMemoryPool<T, BlockSize, MagazineSize>::ReleaseCache(ThreadCache* cache) {
+  std::shared_ptr<Depot> depot = cache->depot.lock();
+  if (depot) {
+    std::lock_guard<std::mutex> lock(depot->mutex);
+    depot->PushMagazine(cache->loaded);
+    depot->PushMagazine(cache->previous);
+  }
+  delete cache;
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::ConcurrentMemoryPool()
+    : id_(NextPoolId()), depot_(std::make_shared<Depot>()) {}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::ConcurrentMemoryPool(const ConcurrentMemoryPool&)
+    : ConcurrentMemoryPool() {}
+
+// The thread caches are keyed by pool id, they follow the depot when both are swapped.
+template <typename T, size_t BlockSize, size_t MagazineSize>
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::ConcurrentMemoryPool(
+    ConcurrentMemoryPool&& memoryPool) noexcept
+    : ConcurrentMemoryPool() {
+  std::swap(id_, memoryPool.id_);
+  depot_.swap(memoryPool.depot_);
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+template <class U>
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::ConcurrentMemoryPool(
+    const ConcurrentMemoryPool<U, BlockSize, MagazineSize>&)
+    : ConcurrentMemoryPool() {}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>&
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::operator=(
+    ConcurrentMemoryPool&& memoryPool) noexcept {
+  if (this != &memoryPool) {
+    std::swap(id_, memoryPool.id_);
+    depot_.swap(memoryPool.depot_);
+  }
+  return *this;
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::~ConcurrentMemoryPool() noexcept {
+  // Caches of other threads are dropped lazily, they only hold a weak reference to the depot.
+  LastCache& last = Last();
+  if (!last.exited) {
+    std::vector<ThreadCache*>& caches = Caches().caches;
+    for (size_t i = 0; i < caches.size(); i++) {
+      if (caches[i]->pool_id == id_) {
+        delete caches[i];
+        caches.erase(caches.begin() + i);
+        break;
+      }
+    }
+    if (last.pool_id == id_) {
+      last.pool_id = 0;
+      last.cache = nullptr;
+    }
+  }
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+inline typename ConcurrentMemoryPool<T, BlockSize, MagazineSize>::ThreadCache*
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::LocalCache() {
+  LastCache& last = Last();
+  if (last.pool_id == id_)
+    return last.cache;
+  return FindOrCreateCache();
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+typename ConcurrentMemoryPool<T, BlockSize, MagazineSize>::ThreadCache*
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::FindOrCreateCache() {
+  LastCache& last = Last();
+  if (last.exited)
+    return nullptr;
+
+  std::vector<ThreadCache*>& caches = Caches().caches;
+  ThreadCache* result = nullptr;
+  for (size_t i = 0; i < caches.size();) {
+    if (caches[i]->pool_id == id_) {
+      result = caches[i];
+      i++;
+    }
+    else if (caches[i]->depot.expired()) {
+      // The pool is gone together with the slots this cache pointed to.
+      delete caches[i];
+      caches.erase(caches.begin() + i);
+    }
+    else {
+      i++;
+    }
+  }
+
+  if (!result) {
+    result = new ThreadCache;
+    result->pool_id = id_;
+    result->depot = depot_;
+    {
+      std::lock_guard<std::mutex> lock(depot_->mutex);
+      result->loaded = depot_->NewMagazine();
+      result->previous = depot_->NewMagazine();
+    }
+    caches.push_back(result);
+  }
+
+  last.pool_id = id_;
+  last.cache = result;
+  return result;
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+inline typename ConcurrentMemoryPool<T, BlockSize, MagazineSize>::pointer
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::allocate(size_type n, const_pointer) {
+  if (n != 1)
+    return reinterpret_cast<pointer>(operator new(n * sizeof(value_type)));
+
+  ThreadCache* cache = LocalCache();
+  if (cache == nullptr) {
+    // Called while the thread is exiting, go straight to the depot.
+    std::lock_guard<std::mutex> lock(depot_->mutex);
+    if (depot_->loose == nullptr) {
+      if (depot_->current_slot >= depot_->last_slot)
+        depot_->AllocateBlock();
+      return reinterpret_cast<pointer>(depot_->current_slot++);
+    }
+    slot_pointer result = depot_->loose;
+    depot_->loose = result->next;
+    return reinterpret_cast<pointer>(result);
+  }
+
+  Magazine* loaded = cache->loaded;
+  if (loaded->count > 0)
+    return reinterpret_cast<pointer>(loaded->slots[--loaded->count]);
+
+  if (cache->previous->count > 0) {
+    std::swap(cache->loaded, cache->previous);
+  }
+  else {
+    std::lock_guard<std::mutex> lock(depot_->mutex);
+    if (depot_->full) {
+      Magazine* m = depot_->full;
+      depot_->full = m->next;
+      depot_->PushMagazine(cache->previous);
+      cache->previous = cache->loaded;
+      cache->loaded = m;
+    }
+    else {
+      depot_->Fill(cache->loaded);
+    }
+  }
+
+  loaded = cache->loaded;
+  return reinterpret_cast<pointer>(loaded->slots[--loaded->count]);
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+inline void ConcurrentMemoryPool<T, BlockSize, MagazineSize>::deallocate(pointer p, size_type n) {
+  if (p == nullptr)
+    return;
+
+  if (n != 1) {
+    operator delete(reinterpret_cast<void*>(p));
+    return;
+  }
+
+  slot_pointer slot = reinterpret_cast<slot_pointer>(p);
+  ThreadCache* cache = LocalCache();
+  if (cache == nullptr) {
+    std::lock_guard<std::mutex> lock(depot_->mutex);
+    slot->next = depot_->loose;
+    depot_->loose = slot;
+    return;
+  }
+
+  Magazine* loaded = cache->loaded;
+  if (loaded->count < MagazineSize) {
+    loaded->slots[loaded->count++] = slot;
+    return;
+  }
+
+  if (cache->previous->count == 0) {
+    std::swap(cache->loaded, cache->previous);
+  }
+  else {
+    std::lock_guard<std::mutex> lock(depot_->mutex);
+    depot_->PushMagazine(cache->previous);
+    cache->previous = cache->loaded;
+    cache->loaded = depot_->NewMagazine();
+  }
+
+  loaded = cache->loaded;
+  loaded->slots[loaded->count++] = slot;
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+void ConcurrentMemoryPool<T, BlockSize, MagazineSize>::FlushThreadCache() {
+  ThreadCache* cache = LocalCache();
+  if (cache == nullptr)
+    return;
+
+  std::lock_guard<std::mutex> lock(depot_->mutex);
+  Magazine* loaded = cache->loaded;
+  Magazine* previous = cache->previous;
+  cache->loaded = depot_->NewMagazine();
+  cache->previous = depot_->NewMagazine();
+  depot_->PushMagazine(loaded);
+  depot_->PushMagazine(previous);
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+inline typename ConcurrentMemoryPool<T, BlockSize, MagazineSize>::size_type
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::max_size() const noexcept {
+  size_type maxBlocks = -1 / BlockSize;
+  return (BlockSize - sizeof(data_pointer)) / sizeof(slot_type) * maxBlocks;
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+template <class... Args>
+inline typename ConcurrentMemoryPool<T, BlockSize, MagazineSize>::pointer
+ConcurrentMemoryPool<T, BlockSize, MagazineSize>::newElement(Args&&... args) {
+  pointer result = allocate();
+  construct<value_type>(result, std::forward<Args>(args)...);
+  return result;
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+inline void ConcurrentMemoryPool<T, BlockSize, MagazineSize>::deleteElement(pointer p) {
+  if (p != nullptr) {
+    p->~value_type();
+    deallocate(p);
+  }
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+inline bool operator==(const ConcurrentMemoryPool<T, BlockSize, MagazineSize>& a,
+                       const ConcurrentMemoryPool<T, BlockSize, MagazineSize>& b) noexcept {
+  return &a == &b;
+}
+
+template <typename T, size_t BlockSize, size_t MagazineSize>
+inline bool operator!=(const ConcurrentMemoryPool<T, BlockSize, MagazineSize>& a,
+                       const ConcurrentMemoryPool<T, BlockSize, MagazineSize>& b) noexcept {
+  return !(a == b);
+}
+}  // namespace akali
+#endif  // AKALI_CONCURRENT_MEMORY_POOL_H_
@@ -0,0 +1,222 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_COROUTINE_H_
+#define AKALI_COROUTINE_H_
+
+#if !defined(__cpp_impl_coroutine)
+#error "akali/coroutine.hpp needs C++20 coroutines, configure with ENABLE_COROUTINES=ON"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <optional>
+#include <utility>
+#include "akali/constructormagic.h"
+#include "akali/future.hpp"
+#include "akali/size_class_pool.hpp"
+#include "akali/thread.hpp"
+#include "akali/thread_pool.hpp"
+
+/*
+C++20 coroutines on top of ThreadPool and Thread, the only part of akali that needs C++20.
+
+co_await pool.schedule() moves the coroutine onto a pool worker, co_await thread.SwitchTo() onto
+an akali::Thread. Either posts a Task holding just the coroutine handle, which fits the Task's
+inline storage, so a hop allocates nothing once the pool is warm. When the executor drops that
+Task instead of running it (ThreadPool::shutdown(kDiscardPending), a Thread destroyed with the
+task queued), the coroutine is resumed on the dropping thread and co_await throws
+std::future_error(broken_promise), so the frame is freed and to_future()'s future fails.
+
+task<T> is a lazy coroutine: it starts when it is co_awaited and resumes its awaiter, through
+symmetric transfer, on whatever thread it finished on. A chain of tasks therefore follows the
+executors it switches to without going back through a queue. An exception escaping the task is
+rethrown by co_await. Frames are allocated from SizeClassPool::Default().
+
+to_future() starts a task from ordinary code and returns an akali::Future of its result,
+sync_wait() blocks until it is done.
+*/
+
+namespace akali {
+template <class T = void>
+class task;
+
+namespace internal {
+// Coroutine frames come from the size class pool instead of the heap.
+struct PooledFrame {
+  static void* operator new(size_t size) { return SizeClassPool::Default().Allocate(size); }
+  static void operator delete(void* p, size_t size) {
+    SizeClassPool::Default().Deallocate(p, size);
+  }
+};
+
+struct TaskPromiseBase : PooledFrame {
+  // Hands the thread to the awaiting coroutine, if there is one.
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      std::coroutine_handle<> continuation = handle.promise().continuation;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() noexcept { error = std::current_exception(); }
+
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+};
+
+template <class T>
+struct TaskPromise : TaskPromiseBase {
+  task<T> get_return_object() noexcept;
+
+  template <class U>
+  void return_value(U&& v) {
+    value.emplace(std::forward<U>(v));
+  }
+
+  T result() {
+    if (error)
+      std::rethrow_exception(error);
+    return std::move(*value);
+  }
+
+  std::optional<T> value;
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+  task<void> get_return_object() noexcept;
+
+  void return_void() const noexcept {}
+
+  void result() {
+    if (error)
+      std::rethrow_exception(error);
+  }
+};
+
+// Runs a task to completion on its own, see to_future().
+struct Detached {
+  struct promise_type : PooledFrame {
+    Detached get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    // Drive() catches everything.
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+}  // namespace internal
+
+template <class T>
+class task {
+ public:
+  using promise_type = internal::TaskPromise<T>;
+
+  struct Awaiter {
+    bool await_ready() const noexcept { return handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+      handle.promise().continuation = awaiting;
+      return handle;
+    }
+    T await_resume() { return handle.promise().result(); }
+
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  task() noexcept {}
+  task(task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      if (handle_)
+        handle_.destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  ~task() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  bool valid() const noexcept { return handle_ != nullptr; }
+  bool is_ready() const noexcept { return handle_ && handle_.done(); }
+
+  // starts the task, the awaiting coroutine resumes where the task finishes
+  Awaiter operator co_await() && {
+    if (!handle_)
+      throw std::future_error(std::future_errc::no_state);
+    return Awaiter{handle_};
+  }
+
+ private:
+  friend struct internal::TaskPromise<T>;
+
+  explicit task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(task);
+};
+
+namespace internal {
+template <class T>
+task<T> TaskPromise<T>::get_return_object() noexcept {
+  return task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline task<void> TaskPromise<void>::get_return_object() noexcept {
+  return task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+template <class T>
+Detached Drive(task<T> t, Promise<T> promise) {
+  try {
+    promise.set_value(co_await std::move(t));
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+  }
+}
+
+inline Detached Drive(task<void> t, Promise<void> promise) {
+  try {
+    co_await std::move(t);
+    promise.set_value();
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+  }
+}
+}  // namespace internal
+
+// starts the task on the calling thread, it runs until its first hop
+template <class T>
+Future<T> to_future(task<T> t) {
+  Promise<T> promise;
+  Future<T> result = promise.get_future();
+  internal::Drive(std::move(t), std::move(promise));
+  return result;
+}
+
+template <class T>
+T sync_wait(task<T> t) {
+  return to_future(std::move(t)).get();
+}
+}  // namespace akali
+#endif  // AKALI_COROUTINE_H_
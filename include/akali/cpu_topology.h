@@ -0,0 +1,40 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_CPU_TOPOLOGY_H_
+#define AKALI_CPU_TOPOLOGY_H_
+#pragma once
+
+#include <vector>
+#include "akali/akali_export.h"
+
+namespace akali {
+struct CpuInfo {
+  int cpu;      // logical CPU number, as taken by SetCurrentThreadAffinity()
+  int core;     // physical core, numbered across all packages
+  int package;  // socket
+  int node;     // NUMA node
+};
+
+// The logical CPUs the process may run on, ordered by number. Empty where the topology can't be
+// read. On Windows only the first 64 CPUs (processor group 0) are reported.
+AKALI_API std::vector<CpuInfo> GetCpuTopology();
+
+// The first logical CPU of every physical core, ordered by NUMA node and core.
+AKALI_API std::vector<CpuInfo> GetPhysicalCores();
+
+// Restricts the calling thread to `cpus`, false when unsupported or when the call failed.
+AKALI_API bool SetCurrentThreadAffinity(const std::vector<int>& cpus);
+}  // namespace akali
+#endif  // !AKALI_CPU_TOPOLOGY_H_
@@ -0,0 +1,542 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_FUTURE_H_
+#define AKALI_FUTURE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "akali/akali_export.h"
+#include "akali/constructormagic.h"
+#include "akali/size_class_pool.hpp"
+#include "akali/task.hpp"
+
+/*
+Future and Promise work like std::future and std::promise, and a Future can be continued instead
+of waited for.
+
+then(fn) runs fn(value), or fn() for Future<void>, once the value is there and returns the future
+of fn's result. The continuation runs on the thread that fulfils the promise, or right away on the
+calling thread when the future is already ready. then_on(executor, fn) posts the continuation to
+a ThreadPool (post()) or a Thread (PostTask()) instead, the executor must outlive the future. An
+exception, thrown by the promise's producer or by a continuation, skips the continuations after
+it and is rethrown by get() at the end of the chain. A continuation that its executor rejects
+fails with std::future_errc::broken_promise.
+
+then(), then_on() and get() consume the future, as with std::future::get(), valid() is false
+afterwards.
+
+when_all() and when_any() return a future of the input futures, which becomes ready when all of
+them, or the first one, are ready (as in the Concurrency TS). Neither blocks a thread.
+
+The shared state is allocated from SizeClassPool::Default().
+*/
+
+namespace akali {
+template <class T>
+class Future;
+template <class T>
+class Promise;
+
+namespace internal {
+class FutureStateBase {
+ public:
+  FutureStateBase() : ready_(false) {}
+
+  bool Ready() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ready_;
+  }
+
+  void Wait() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return ready_; });
+  }
+
+  template <class Rep, class Period>
+  bool WaitFor(const std::chrono::duration<Rep, Period>& timeout) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return cond_.wait_for(lock, timeout, [this] { return ready_; });
+  }
+
+  // Runs `callback` once the state is ready, right away on the calling thread if it already is.
+  void OnReady(Task&& callback) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!ready_) {
+        callbacks_.push_back(std::move(callback));
+        return;
+      }
+    }
+    callback();
+  }
+
+  void SetException(std::exception_ptr error) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    CheckUnsatisfied();
+    error_ = error;
+    MarkReady(lock);
+  }
+
+  // Only once ready.
+  const std::exception_ptr& Error() const { return error_; }
+
+ protected:
+  void CheckUnsatisfied() const {
+    if (ready_)
+      throw std::future_error(std::future_errc::promise_already_satisfied);
+  }
+
+  void MarkReady(std::unique_lock<std::mutex>& lock) {
+    ready_ = true;
+    std::vector<Task> callbacks;
+    callbacks.swap(callbacks_);
+    lock.unlock();
+    cond_.notify_all();
+    for (Task& callback : callbacks)
+      callback();
+  }
+
+  mutable std::mutex mutex_;
+  mutable std::condition_variable cond_;
+  bool ready_;
+  std::exception_ptr error_;
+  std::vector<Task> callbacks_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(FutureStateBase);
+};
+
+template <class T>
+class FutureState : public FutureStateBase {
+ public:
+  FutureState() : has_value_(false) {}
+  ~FutureState() {
+    if (has_value_)
+      reinterpret_cast<T*>(&storage_)->~T();
+  }
+
+  template <class U>
+  void SetValue(U&& value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    CheckUnsatisfied();
+    new (&storage_) T(std::forward<U>(value));
+    has_value_ = true;
+    MarkReady(lock);
+  }
+
+  // Only once ready without an error, the value can be taken once.
+  T Take() { return std::move(*reinterpret_cast<T*>(&storage_)); }
+
+ private:
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+  bool has_value_;
+};
+
+template <>
+class FutureState<void> : public FutureStateBase {
+ public:
+  void SetValue() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    CheckUnsatisfied();
+    MarkReady(lock);
+  }
+
+  void Take() {}
+};
+
+template <class T>
+std::shared_ptr<FutureState<T>> MakeFutureState() {
+  return std::allocate_shared<FutureState<T>>(SizeClassAllocator<FutureState<T>>());
+}
+
+struct FutureAccess {
+  template <class T>
+  static const std::shared_ptr<FutureState<T>>& State(const Future<T>& future) {
+    return future.state_;
+  }
+};
+
+// The result of a continuation taking T.
+template <class T, class F>
+struct ContinuationResult {
+  typedef typename std::result_of<F(T)>::type type;
+};
+
+template <class F>
+struct ContinuationResult<void, F> {
+  typedef typename std::result_of<F()>::type type;
+};
+
+template <class T>
+struct Apply {
+  template <class F>
+  static auto Call(F& f, FutureState<T>& state) -> decltype(f(state.Take())) {
+    return f(state.Take());
+  }
+};
+
+template <>
+struct Apply<void> {
+  template <class F>
+  static auto Call(F& f, FutureState<void>&) -> decltype(f()) {
+    return f();
+  }
+};
+
+}  // namespace internal
+
+template <class T>
+class Promise {
+ public:
+  Promise() : state_(internal::MakeFutureState<T>()), retrieved_(false) {}
+  Promise(Promise&& other) noexcept
+      : state_(std::move(other.state_)), retrieved_(other.retrieved_) {}
+  Promise& operator=(Promise&& other) noexcept {
+    if (this != &other) {
+      Abandon();
+      state_ = std::move(other.state_);
+      retrieved_ = other.retrieved_;
+    }
+    return *this;
+  }
+  ~Promise() { Abandon(); }
+
+  Future<T> get_future() {
+    CheckState();
+    if (retrieved_)
+      throw std::future_error(std::future_errc::future_already_retrieved);
+    retrieved_ = true;
+    return Future<T>(state_);
+  }
+
+  template <class U = T>
+  void set_value(U&& value) {
+    CheckState();
+    state_->SetValue(std::forward<U>(value));
+  }
+
+  // Promise<void> only
+  void set_value() {
+    CheckState();
+    state_->SetValue();
+  }
+
+  void set_exception(std::exception_ptr error) {
+    CheckState();
+    state_->SetException(error);
+  }
+
+ private:
+  void CheckState() const {
+    if (!state_)
+      throw std::future_error(std::future_errc::no_state);
+  }
+
+  void Abandon() {
+    if (state_ && !state_->Ready()) {
+      try {
+        state_->SetException(
+            std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+      } catch (const std::future_error&) {
+        // Satisfied by another thread in between.
+      }
+    }
+  }
+
+  std::shared_ptr<internal::FutureState<T>> state_;
+  bool retrieved_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(Promise);
+};
+
+namespace internal {
+template <class R>
+struct Fulfil {
+  template <class G>
+  static void Run(Promise<R>& promise, G& g) {
+    promise.set_value(g());
+  }
+};
+
+template <>
+struct Fulfil<void> {
+  template <class G>
+  static void Run(Promise<void>& promise, G& g) {
+    g();
+    promise.set_value();
+  }
+};
+
+// Calls f and fulfils the promise with its result or exception.
+template <class R, class F>
+class FulfilCall {
+ public:
+  FulfilCall(F&& f, Promise<R>&& promise) : f_(std::move(f)), promise_(std::move(promise)) {}
+  FulfilCall(FulfilCall&& other) = default;
+
+  void operator()() {
+    try {
+      Fulfil<R>::Run(promise_, f_);
+    } catch (...) {
+      promise_.set_exception(std::current_exception());
+    }
+  }
+
+ private:
+  F f_;
+  Promise<R> promise_;
+};
+
+// Runs fn on the value of `in` and fulfils the promise of the continued future.
+template <class T, class R, class F>
+class Continuation {
+ public:
+  template <class G>
+  Continuation(std::shared_ptr<FutureState<T>> in, G&& fn, Promise<R>&& promise)
+      : in_(std::move(in)), fn_(std::forward<G>(fn)), promise_(std::move(promise)) {}
+  Continuation(Continuation&& other) = default;
+
+  void operator()() {
+    if (in_->Error()) {
+      promise_.set_exception(in_->Error());
+      return;
+    }
+    try {
+      FutureState<T>* in = in_.get();
+      F* fn = &fn_;
+      auto call = [in, fn]() { return Apply<T>::Call(*fn, *in); };
+      Fulfil<R>::Run(promise_, call);
+    } catch (...) {
+      promise_.set_exception(std::current_exception());
+    }
+  }
+
+ private:
+  std::shared_ptr<FutureState<T>> in_;
+  F fn_;
+  Promise<R> promise_;
+};
+
+template <class E>
+auto PostTo(E& executor, Task&& task, int) -> decltype(executor.post(std::move(task)), void()) {
+  executor.post(std::move(task));
+}
+
+template <class E>
+auto PostTo(E& executor, Task&& task, long) -> decltype(executor.PostTask(std::move(task)), void()) {
+  executor.PostTask(std::move(task));
+}
+
+template <class E, class C>
+class Dispatch {
+ public:
+  Dispatch(E* executor, C&& call) : executor_(executor), call_(std::move(call)) {}
+  Dispatch(Dispatch&& other) = default;
+
+  void operator()() {
+    try {
+      PostTo(*executor_, Task(std::move(call_)), 0);
+    } catch (...) {
+      // The dropped continuation breaks its promise.
+    }
+  }
+
+ private:
+  E* executor_;
+  C call_;
+};
+}  // namespace internal
+
+template <class T>
+class Future {
+ public:
+  Future() noexcept {}
+  Future(Future&& other) noexcept : state_(std::move(other.state_)) {}
+  Future& operator=(Future&& other) noexcept {
+    state_ = std::move(other.state_);
+    return *this;
+  }
+
+  bool valid() const noexcept { return state_ != nullptr; }
+
+  bool is_ready() const {
+    CheckState();
+    return state_->Ready();
+  }
+
+  void wait() const {
+    CheckState();
+    state_->Wait();
+  }
+
+  template <class Rep, class Period>
+  std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const {
+    CheckState();
+    return state_->WaitFor(timeout) ? std::future_status::ready : std::future_status::timeout;
+  }
+
+  // Waits for the value and returns it, or rethrows the exception.
+  T get() {
+    CheckState();
+    std::shared_ptr<internal::FutureState<T>> state = std::move(state_);
+    state->Wait();
+    if (state->Error())
+      std::rethrow_exception(state->Error());
+    return state->Take();
+  }
+
+  template <class F>
+  auto then(F&& fn) -> Future<typename internal::ContinuationResult<T, F>::type> {
+    typedef typename internal::ContinuationResult<T, F>::type R;
+    typedef internal::Continuation<T, R, typename std::decay<F>::type> Call;
+
+    CheckState();
+    Promise<R> promise;
+    Future<R> result = promise.get_future();
+    std::shared_ptr<internal::FutureState<T>> state = std::move(state_);
+    internal::FutureState<T>* in = state.get();
+    in->OnReady(Task(Call(std::move(state), std::forward<F>(fn), std::move(promise))));
+    return result;
+  }
+
+  template <class Executor, class F>
+  auto then_on(Executor& executor, F&& fn)
+      -> Future<typename internal::ContinuationResult<T, F>::type> {
+    typedef typename internal::ContinuationResult<T, F>::type R;
+    typedef internal::Continuation<T, R, typename std::decay<F>::type> Call;
+
+    CheckState();
+    Promise<R> promise;
+    Future<R> result = promise.get_future();
+    std::shared_ptr<internal::FutureState<T>> state = std::move(state_);
+    internal::FutureState<T>* in = state.get();
+    in->OnReady(Task(internal::Dispatch<Executor, Call>(
+        &executor, Call(std::move(state), std::forward<F>(fn), std::move(promise)))));
+    return result;
+  }
+
+ private:
+  friend class Promise<T>;
+  friend struct internal::FutureAccess;
+
+  explicit Future(std::shared_ptr<internal::FutureState<T>> state) : state_(std::move(state)) {}
+
+  void CheckState() const {
+    if (!state_)
+      throw std::future_error(std::future_errc::no_state);
+  }
+
+  std::shared_ptr<internal::FutureState<T>> state_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(Future);
+};
+
+template <class T>
+Future<typename std::decay<T>::type> make_ready_future(T&& value) {
+  Promise<typename std::decay<T>::type> promise;
+  promise.set_value(std::forward<T>(value));
+  return promise.get_future();
+}
+
+inline Future<void> make_ready_future() {
+  Promise<void> promise;
+  promise.set_value();
+  return promise.get_future();
+}
+
+template <class T>
+struct WhenAnyResult {
+  size_t index;
+  std::vector<Future<T>> futures;
+};
+
+namespace internal {
+template <class T>
+struct WhenAll {
+  std::vector<Future<T>> futures;
+  std::atomic<size_t> left;
+  Promise<std::vector<Future<T>>> promise;
+};
+
+template <class T>
+struct WhenAny {
+  WhenAnyResult<T> result;
+  std::atomic<bool> done;
+  Promise<WhenAnyResult<T>> promise;
+};
+}  // namespace internal
+
+// Ready once every future is, with the futures ready to get().
+template <class T>
+Future<std::vector<Future<T>>> when_all(std::vector<Future<T>> futures) {
+  std::shared_ptr<internal::WhenAll<T>> all = std::make_shared<internal::WhenAll<T>>();
+  Future<std::vector<Future<T>>> result = all->promise.get_future();
+  if (futures.empty()) {
+    all->promise.set_value(std::move(futures));
+    return result;
+  }
+
+  // The last callback moves the futures out, don't iterate over them meanwhile.
+  std::vector<std::shared_ptr<internal::FutureState<T>>> states;
+  for (const Future<T>& future : futures)
+    states.push_back(internal::FutureAccess::State(future));
+  all->left = futures.size();
+  all->futures = std::move(futures);
+  for (const std::shared_ptr<internal::FutureState<T>>& state : states) {
+    state->OnReady(Task([all]() {
+      if (all->left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        all->promise.set_value(std::move(all->futures));
+    }));
+  }
+  return result;
+}
+
+// Ready once one of the futures is, result.index tells which.
+template <class T>
+Future<WhenAnyResult<T>> when_any(std::vector<Future<T>> futures) {
+  std::shared_ptr<internal::WhenAny<T>> any = std::make_shared<internal::WhenAny<T>>();
+  Future<WhenAnyResult<T>> result = any->promise.get_future();
+  any->done = false;
+  if (futures.empty()) {
+    any->result.index = size_t(-1);
+    any->promise.set_value(std::move(any->result));
+    return result;
+  }
+
+  std::vector<std::shared_ptr<internal::FutureState<T>>> states;
+  for (const Future<T>& future : futures)
+    states.push_back(internal::FutureAccess::State(future));
+  any->result.futures = std::move(futures);
+  for (size_t i = 0; i < states.size(); i++) {
+    states[i]->OnReady(Task([any, i]() {
+      if (!any->done.exchange(true, std::memory_order_acq_rel)) {
+        any->result.index = i;
+        any->promise.set_value(std::move(any->result));
+      }
+    }));
+  }
+  return result;
+}
+}  // namespace akali
+#endif  // AKALI_FUTURE_H_
@@ -0,0 +1,47 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_LOCATION_H_
+#define AKALI_LOCATION_H_
+#pragma once
+
+#include <string>
+
+namespace akali {
+// Where a task was posted from, see Thread::InvokeFrom(). The strings are literals, a Location is
+// cheap to copy and never owns memory.
+class Location {
+ public:
+  Location() : function_name_("unknown"), file_name_("unknown"), line_number_(0) {}
+  Location(const char* function_name, const char* file_name, int line_number)
+      : function_name_(function_name), file_name_(file_name), line_number_(line_number) {}
+
+  const char* function_name() const { return function_name_; }
+  const char* file_name() const { return file_name_; }
+  int line_number() const { return line_number_; }
+
+  std::string ToString() const {
+    return std::string(function_name_) + "@" + file_name_ + ":" + std::to_string(line_number_);
+  }
+
+ private:
+  const char* function_name_;
+  const char* file_name_;
+  int line_number_;
+};
+}  // namespace akali
+
+#define AKALI_FROM_HERE ::akali::Location(__FUNCTION__, __FILE__, __LINE__)
+
+#endif  // !AKALI_LOCATION_H_
@@ -0,0 +1,336 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_LOCKFREE_MEMORY_POOL_H_
+#define AKALI_LOCKFREE_MEMORY_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "akali/akali_export.h"
+
+/*
+LockFreeMemoryPool is a MemoryPool whose free list is a lock-free Treiber stack, meant for pools
+shared by a fixed set of threads (e.g. I/O threads) where a thread must never block on another.
+
+The head of the free list is a tagged pointer: the slot address and a modification counter are
+packed into one 64-bit word, so a single-word CAS detects the ABA problem. On 64-bit targets the
+address takes the low 48 bits and the tag the high 16 bits; on 32-bit targets each gets 32 bits.
+A block whose addresses need the high bits (5-level paging, ARM top-byte tags or MTE) cannot be
+packed, Grow() then throws std::runtime_error rather than corrupting the list.
+
+Once the pool holds enough blocks for its peak, allocate/deallocate are a couple of atomic
+operations. Only an empty free list takes a mutex and asks the system for a new block. Blocks are
+only released when the pool is destroyed, which is also what makes reading `next` of a slot that
+was concurrently popped safe. Moving a pool moves its blocks, a copy is a new empty pool.
+
+It is a class of its own rather than a free list policy of MemoryPool: MemoryPool's scrub, trim
+and stats policies update plain members on every call and Trim() releases blocks, neither of
+which holds up without a lock.
+*/
+
+namespace akali {
+template <typename T, size_t BlockSize = 65536>
+class LockFreeMemoryPool {
+ public:
+  /* Member types */
+  typedef T value_type;
+  typedef T* pointer;
+  typedef T& reference;
+  typedef const T* const_pointer;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef std::false_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  template <typename U>
+  struct rebind {
+    typedef LockFreeMemoryPool<U, BlockSize> other;
+  };
+
+  /* Member functions */
+  LockFreeMemoryPool() noexcept;
+  LockFreeMemoryPool(const LockFreeMemoryPool& memoryPool) noexcept;
+  LockFreeMemoryPool(LockFreeMemoryPool&& memoryPool) noexcept;
+  template <class U>
+  LockFreeMemoryPool(const LockFreeMemoryPool<U, BlockSize>& memoryPool) noexcept;
+
+  ~LockFreeMemoryPool() noexcept;
+
+  LockFreeMemoryPool& operator=(const LockFreeMemoryPool& memoryPool) = delete;
+  LockFreeMemoryPool& operator=(LockFreeMemoryPool&& memoryPool) noexcept;
+
+  pointer address(reference x) const noexcept { return &x; }
+  const_pointer address(const_reference x) const noexcept { return &x; }
+
+  // Serves one object per call, other counts are forwarded to the global heap. hint is ignored.
+  pointer allocate(size_type n = 1, const_pointer hint = 0);
+  void deallocate(pointer p, size_type n = 1);
+
+  size_type max_size() const noexcept;
+
+  template <class U, class... Args>
+  void construct(U* p, Args&&... args) {
+    new (p) U(std::forward<Args>(args)...);
+  }
+  template <class U>
+  void destroy(U* p) {
+    p->~U();
+  }
+
+  template <class... Args>
+  pointer newElement(Args&&... args);
+  void deleteElement(pointer p);
+
+  // Makes sure at least `count` slots can be served without growing the pool.
+  void Reserve(size_type count);
+
+ private:
+  union Slot_ {
+    typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type element;
+    std::atomic<Slot_*> next;
+  };
+
+  typedef char* data_pointer;
+  typedef Slot_ slot_type;
+  typedef Slot_* slot_pointer;
+  typedef uint64_t tagged_pointer;
+
+#if UINTPTR_MAX > 0xFFFFFFFFu
+  static const int kTagShift = 48;
+#else
+  static const int kTagShift = 32;
+#endif
+  static const tagged_pointer kPointerMask = (tagged_pointer(1) << kTagShift) - 1;
+
+  static slot_pointer Ptr(tagged_pointer v) noexcept {
+    return reinterpret_cast<slot_pointer>(static_cast<uintptr_t>(v & kPointerMask));
+  }
+  static tagged_pointer Pack(slot_pointer p, tagged_pointer tag) noexcept {
+    return (static_cast<tagged_pointer>(reinterpret_cast<uintptr_t>(p)) & kPointerMask) |
+           (tag << kTagShift);
+  }
+  static tagged_pointer Tag(tagged_pointer v) noexcept { return v >> kTagShift; }
+
+  slot_pointer Pop() noexcept;
+  void Push(slot_pointer first, slot_pointer last) noexcept;
+  slot_pointer Grow();
+  // Not thread safe, the pools must not be in use.
+  void Swap(LockFreeMemoryPool& memoryPool) noexcept;
+
+  std::atomic<tagged_pointer> head_;
+
+  // Only taken on the slow path, when the free list is empty.
+  std::mutex grow_mutex_;
+  slot_pointer current_block_;
+
+  static_assert(BlockSize >= 2 * sizeof(slot_type), "BlockSize too small.");
+};
+
+template <typename T, size_t BlockSize>
+LockFreeMemoryPool<T, BlockSize>::LockFreeMemoryPool() noexcept
+    : head_(0), current_block_(nullptr) {}
+
+template <typename T, size_t BlockSize>
+LockFreeMemoryPool<T, BlockSize>::LockFreeMemoryPool(const LockFreeMemoryPool&) noexcept
+    : LockFreeMemoryPool() {}
+
+template <typename T, size_t BlockSize>
+LockFreeMemoryPool<T, BlockSize>::LockFreeMemoryPool(LockFreeMemoryPool&& memoryPool) noexcept
+    : LockFreeMemoryPool() {
+  Swap(memoryPool);
+}
+
+template <typename T, size_t BlockSize>
+template <class U>
+LockFreeMemoryPool<T, BlockSize>::LockFreeMemoryPool(
+    const LockFreeMemoryPool<U, BlockSize>&) noexcept
+    : LockFreeMemoryPool() {}
+
+template <typename T, size_t BlockSize>
+LockFreeMemoryPool<T, BlockSize>& LockFreeMemoryPool<T, BlockSize>::operator=(
+    LockFreeMemoryPool&& memoryPool) noexcept {
+  if (this != &memoryPool)
+    Swap(memoryPool);
+  return *this;
+}
+
+template <typename T, size_t BlockSize>
+void LockFreeMemoryPool<T, BlockSize>::Swap(LockFreeMemoryPool& memoryPool) noexcept {
+  tagged_pointer head = head_.load(std::memory_order_relaxed);
+  head_.store(memoryPool.head_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  memoryPool.head_.store(head, std::memory_order_relaxed);
+  std::swap(current_block_, memoryPool.current_block_);
+}
+
+template <typename T, size_t BlockSize>
+LockFreeMemoryPool<T, BlockSize>::~LockFreeMemoryPool() noexcept {
+  slot_pointer curr = current_block_;
+  while (curr != nullptr) {
+    slot_pointer prev = curr->next.load(std::memory_order_relaxed);
+    operator delete(reinterpret_cast<void*>(curr));
+    curr = prev;
+  }
+}
+
+template <typename T, size_t BlockSize>
+inline typename LockFreeMemoryPool<T, BlockSize>::slot_pointer
+LockFreeMemoryPool<T, BlockSize>::Pop() noexcept {
+  tagged_pointer old_head = head_.load(std::memory_order_acquire);
+  for (;;) {
+    slot_pointer top = Ptr(old_head);
+    if (top == nullptr)
+      return nullptr;
+
+    // top may be popped and overwritten by another thread meanwhile, the tag makes the CAS fail.
+    slot_pointer next = top->next.load(std::memory_order_relaxed);
+    tagged_pointer new_head = Pack(next, Tag(old_head) + 1);
+    if (head_.compare_exchange_weak(old_head, new_head, std::memory_order_acquire,
+                                    std::memory_order_acquire))
+      return top;
+  }
+}
+
+template <typename T, size_t BlockSize>
+inline void LockFreeMemoryPool<T, BlockSize>::Push(slot_pointer first, slot_pointer last) noexcept {
+  tagged_pointer old_head = head_.load(std::memory_order_relaxed);
+  tagged_pointer new_head;
+  do {
+    last->next.store(Ptr(old_head), std::memory_order_relaxed);
+    new_head = Pack(first, Tag(old_head) + 1);
+  } while (!head_.compare_exchange_weak(old_head, new_head, std::memory_order_release,
+                                        std::memory_order_relaxed));
+}
+
+template <typename T, size_t BlockSize>
+typename LockFreeMemoryPool<T, BlockSize>::slot_pointer LockFreeMemoryPool<T, BlockSize>::Grow() {
+  std::lock_guard<std::mutex> lock(grow_mutex_);
+
+  // Another thread may have grown the pool while we were waiting.
+  slot_pointer result = Pop();
+  if (result)
+    return result;
+
+  data_pointer new_block = reinterpret_cast<data_pointer>(operator new(BlockSize));
+  uintptr_t block_end = reinterpret_cast<uintptr_t>(new_block) + BlockSize - 1;
+  if ((block_end & ~static_cast<uintptr_t>(kPointerMask)) != 0) {
+    operator delete(new_block);
+    throw std::runtime_error("LockFreeMemoryPool: block address does not fit the tagged pointer");
+  }
+  reinterpret_cast<slot_pointer>(new_block)->next.store(current_block_, std::memory_order_relaxed);
+  current_block_ = reinterpret_cast<slot_pointer>(new_block);
+
+  data_pointer body = new_block + sizeof(slot_pointer);
+  uintptr_t addr = reinterpret_cast<uintptr_t>(body);
+  size_type body_padding = (alignof(slot_type) - addr) % alignof(slot_type);
+  slot_pointer first = reinterpret_cast<slot_pointer>(body + body_padding);
+  slot_pointer end = reinterpret_cast<slot_pointer>(new_block + BlockSize - sizeof(slot_type) + 1);
+
+  // Keep the first slot, publish the rest with a single CAS.
+  result = first++;
+  if (first < end) {
+    slot_pointer last = first;
+    for (; last + 1 < end; last++)
+      last->next.store(last + 1, std::memory_order_relaxed);
+    Push(first, last);
+  }
+  return result;
+}
+
+template <typename T, size_t BlockSize>
+inline typename LockFreeMemoryPool<T, BlockSize>::pointer LockFreeMemoryPool<T, BlockSize>::allocate(
+    size_type n,
+    const_pointer) {
+  if (n != 1)
+    return reinterpret_cast<pointer>(operator new(n * sizeof(value_type)));
+
+  slot_pointer result = Pop();
+  if (result == nullptr)
+    result = Grow();
+  return reinterpret_cast<pointer>(result);
+}
+
+template <typename T, size_t BlockSize>
+inline void LockFreeMemoryPool<T, BlockSize>::deallocate(pointer p, size_type n) {
+  if (p == nullptr)
+    return;
+
+  if (n != 1) {
+    operator delete(reinterpret_cast<void*>(p));
+    return;
+  }
+
+  slot_pointer slot = reinterpret_cast<slot_pointer>(p);
+  Push(slot, slot);
+}
+
+template <typename T, size_t BlockSize>
+void LockFreeMemoryPool<T, BlockSize>::Reserve(size_type count) {
+  // Draw the slots out and give them back, every block grown on the way stays in the pool.
+  slot_pointer head = nullptr;
+  slot_pointer tail = nullptr;
+  for (size_type i = 0; i < count; i++) {
+    slot_pointer s = reinterpret_cast<slot_pointer>(allocate());
+    s->next.store(head, std::memory_order_relaxed);
+    if (tail == nullptr)
+      tail = s;
+    head = s;
+  }
+  if (head)
+    Push(head, tail);
+}
+
+template <typename T, size_t BlockSize>
+inline typename LockFreeMemoryPool<T, BlockSize>::size_type
+LockFreeMemoryPool<T, BlockSize>::max_size() const noexcept {
+  size_type maxBlocks = -1 / BlockSize;
+  return (BlockSize - sizeof(data_pointer)) / sizeof(slot_type) * maxBlocks;
+}
+
+template <typename T, size_t BlockSize>
+template <class... Args>
+inline typename LockFreeMemoryPool<T, BlockSize>::pointer LockFreeMemoryPool<T, BlockSize>::newElement(
+    Args&&... args) {
+  pointer result = allocate();
+  construct<value_type>(result, std::forward<Args>(args)...);
+  return result;
+}
+
+template <typename T, size_t BlockSize>
+inline void LockFreeMemoryPool<T, BlockSize>::deleteElement(pointer p) {
+  if (p != nullptr) {
+    p->~value_type();
+    deallocate(p);
+  }
+}
+
+template <typename T, size_t BlockSize>
+inline bool operator==(const LockFreeMemoryPool<T, BlockSize>& a,
+                       const LockFreeMemoryPool<T, BlockSize>& b) noexcept {
+  return &a == &b;
+}
+
+template <typename T, size_t BlockSize>
+inline bool operator!=(const LockFreeMemoryPool<T, BlockSize>& a,
+                       const LockFreeMemoryPool<T, BlockSize>& b) noexcept {
+  return !(a == b);
+}
+}  // namespace akali
+#endif  // AKALI_LOCKFREE_MEMORY_POOL_H_
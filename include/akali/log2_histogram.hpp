@@ -0,0 +1,63 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_LOG2_HISTOGRAM_H_
+#define AKALI_LOG2_HISTOGRAM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/*
+Helpers for the log2-bucketed latency histograms of ThreadPoolStats and ThreadTaskStats. Bucket i
+counts the values from 2^i to 2^(i+1) - 1, the first bucket also counts 0 and the last one
+everything larger. Filling a bucket is a count-leading-zeros and an increment, so the histograms
+are cheap enough to keep per task.
+*/
+
+namespace akali {
+enum : size_t { kLog2HistogramBuckets = 40 };
+
+inline size_t Log2Bucket(uint64_t value) {
+  if (value < 2)
+    return 0;
+#if defined(__GNUC__) || defined(__clang__)
+  size_t log = 63 - __builtin_clzll(value);
+#else
+  size_t log = 0;
+  while (value >>= 1)
+    log++;
+#endif
+  return std::min(log, size_t(kLog2HistogramBuckets - 1));
+}
+
+// Upper bound of the bucket holding quantile q (0 to 1) of a histogram, 0 when it's empty.
+inline uint64_t Log2Percentile(const uint64_t* counts, size_t buckets, double q) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < buckets; i++)
+    total += counts[i];
+  if (total == 0)
+    return 0;
+  uint64_t rank = static_cast<uint64_t>(std::ceil(std::min(std::max(q, 0.0), 1.0) * total));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets; i++) {
+    seen += counts[i];
+    if (seen >= rank && seen != 0)
+      return uint64_t(1) << (i + 1);
+  }
+  return uint64_t(1) << buckets;
+}
+}  // namespace akali
+#endif  // AKALI_LOG2_HISTOGRAM_H_
@@ -15,11 +15,34 @@
 #ifndef AKALI_MEMORY_POOL_H_
 #define AKALI_MEMORY_POOL_H_
 
+#include <algorithm>
+#include <chrono>
 #include <climits>
 #include <cstddef>
-#include <mutex>
+#include <cstdint>
 #include <memory.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include "akali/akali_export.h"
+#include "akali/trace.h"
+
+#ifdef AKALI_WIN
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(AKALI_ARCH_X86_FAMILY) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define AKALI_MEMORY_POOL_HAS_SSE2
+#include <emmintrin.h>
+#endif
 /*
 MemoryPool is mostly compliant with the C++ Standard Library allocators.
 This means you can use it with `allocator_traits`
@@ -27,19 +50,182 @@ This means you can use it with `allocator_traits`
 or just like you would use the `std::allocator`
 ([see here] (http://www.cplusplus.com/reference/memory/allocator/)).
 
+MemoryPool is a slab allocator: every `BlockSize` block is carved into as many `T` slots as
+fit. Slots that have never been handed out are served from a bump pointer, released slots are
+kept on an intrusive free list and reused first. A new block is only requested from the system
+when both are exhausted.
+
 There are some differences though:
 
-* MemorPool **cannot** allocate multiple objects with a single call to `allocate`
-and will simply ignore the count value you pass to the allocate/deallocate function.
-Fixing this is not too hard, but it would deteriorate performance and create memory fragmentation.
-* This is **NOT** thread safe. You should create a different instance for each thread (suggested)
-or find some way of scheduling queries to the allocator.
+* MemorPool serves single objects only. Calls to allocate/deallocate with a count other than 1
+(e.g. from `std::vector`) are forwarded to the global `operator new`/`operator delete`.
+* This is **NOT** thread safe and takes no lock. You should create a different instance for each
+thread (suggested) or use ConcurrentMemoryPool (see concurrent_memory_pool.hpp) when objects have
+to be shared between threads.
+
+What happens to the content of a released slot is chosen with the Scrub policy:
+* ScrubNone (default): nothing, the slot is reused as is.
+* ScrubObject: the slot is zeroed before it goes back on the free list.
+* ScrubNonTemporal: same, with non-temporal stores (SSE2) that bypass the cache, for large T.
+* ScrubDeferred: released slots are parked and zeroed in batches of kBatchSize, when the free list
+runs dry, on Trim() or when ScrubPending() is called. The content survives until then.
+
+This replaces the former `bool ZeroOnDeallocate` parameter, which was true by default, so
+`MemoryPool<T, N, true/false>` no longer compiles and a plain `MemoryPool<T>` stops zeroing. Write
+`MemoryPool<T, N, ScrubIf<flag>>` to keep the old behaviour.
+
+Memory is only given back on request: Trim() releases every block whose slots are all free,
+SetTrimThreshold() makes deallocate() call it once enough slots are idle. Blocks of at least one
+page are mapped directly from the system, their length rounded up to the page size, and unmapped
+when released, so trimming them lowers the RSS. Smaller blocks come from the heap and only go back
+to it, Counters() tells the two apart. With EnableHugePages(), mapped blocks whose size is a
+multiple of 2 MB are aligned and advised for transparent huge pages (large pages on Windows).
+
+The Stats policy adds instrumentation. With NoPoolStats (default) nothing is counted and the hooks
+compile away. PoolStats counts allocations, live objects and their high-water mark, and lists the
+addresses of the objects still allocated when the pool is destroyed (see OnLeaks()). Snapshot()
+combines the counts with the block usage, the bytes lost to padding and the free list length;
+AllocationRate()/DeallocationRate() turn two snapshots into rates. Use it to pick BlockSize.
 
 Also see: https://blog.csdn.net/china_jeffery/article/details/80750042
 */
 
 namespace akali {
-template <typename T, size_t BlockSize = 4096, bool ZeroOnDeallocate = true> class MemoryPool {
+struct ScrubNone {
+  static const bool kDeferred = false;
+  static const size_t kBatchSize = 1;
+  static void Scrub(void *, size_t) noexcept {}
+};
+
+struct ScrubObject {
+  static const bool kDeferred = false;
+  static const size_t kBatchSize = 1;
+  static void Scrub(void *p, size_t n) noexcept {
+    // Called through a volatile pointer so the stores can't be dropped as dead.
+    static void *(*const volatile zero)(void *, int, size_t) = memset;
+    zero(p, 0, n);
+  }
+};
+
+struct ScrubNonTemporal {
+  static const bool kDeferred = false;
+  static const size_t kBatchSize = 1;
+  static void Scrub(void *p, size_t n) noexcept {
+#ifdef AKALI_MEMORY_POOL_HAS_SSE2
+    char *c = static_cast<char *>(p);
+    size_t head = (16 - reinterpret_cast<uintptr_t>(c) % 16) % 16;
+    if (head > n)
+      head = n;
+    ScrubObject::Scrub(c, head);
+    c += head;
+    n -= head;
+
+    const __m128i zero = _mm_setzero_si128();
+    for (; n >= 16; n -= 16, c += 16)
+      _mm_stream_si128(reinterpret_cast<__m128i *>(c), zero);
+    ScrubObject::Scrub(c, n);
+    _mm_sfence();
+#else
+    ScrubObject::Scrub(p, n);
+#endif
+  }
+};
+
+struct ScrubDeferred {
+  static const bool kDeferred = true;
+  static const size_t kBatchSize = 64;
+  static void Scrub(void *p, size_t n) noexcept { ScrubObject::Scrub(p, n); }
+};
+
+// The policy matching the former ZeroOnDeallocate flag.
+template <bool ZeroOnDeallocate>
+using ScrubIf = typename std::conditional<ZeroOnDeallocate, ScrubObject, ScrubNone>::type;
+
+struct MemoryPoolCounters {
+  size_t blocks_held;       // blocks currently owned by the pool
+  size_t bytes_held;        // blocks_held * BlockSize
+  size_t huge_page_blocks;  // blocks mapped with huge pages so far
+  size_t free_slots;        // released slots waiting on the free list
+  size_t trims;             // Trim() calls that released at least one block
+  size_t blocks_released;   // blocks given back so far
+  size_t bytes_released;    // blocks_released * BlockSize
+  size_t bytes_unmapped;    // returned to the OS, page rounded
+  size_t bytes_freed;       // returned to the heap, blocks smaller than a page
+};
+
+// Stats policy that counts nothing, the hooks compile to nothing.
+struct NoPoolStats {
+  static const bool kEnabled = false;
+  void OnAllocate() noexcept {}
+  void OnDeallocate() noexcept {}
+  size_t Allocations() const noexcept { return 0; }
+  size_t Deallocations() const noexcept { return 0; }
+  size_t Live() const noexcept { return 0; }
+  size_t PeakLive() const noexcept { return 0; }
+  void OnLeaks(const void *, const std::vector<const void *> &, size_t) {}
+};
+
+// Counts allocations and reports the objects still allocated when the pool is destroyed. Derive
+// from it and hide OnLeaks() to send the report somewhere else.
+struct PoolStats {
+  static const bool kEnabled = true;
+  PoolStats() noexcept : allocations_(0), deallocations_(0), live_(0), peak_live_(0) {}
+
+  void OnAllocate() noexcept {
+    allocations_++;
+    if (++live_ > peak_live_)
+      peak_live_ = live_;
+  }
+  void OnDeallocate() noexcept {
+    deallocations_++;
+    live_--;
+  }
+  size_t Allocations() const noexcept { return allocations_; }
+  size_t Deallocations() const noexcept { return deallocations_; }
+  size_t Live() const noexcept { return live_; }
+  size_t PeakLive() const noexcept { return peak_live_; }
+
+  void OnLeaks(const void *pool, const std::vector<const void *> &objects, size_t size) {
+    TraceMsgA("MemoryPool %p: %u objects of %u bytes still allocated", pool,
+              static_cast<unsigned>(objects.size()), static_cast<unsigned>(size));
+    for (const void *p : objects)
+      TraceMsgA("  leaked %p", p);
+  }
+
+private:
+  size_t allocations_;
+  size_t deallocations_;
+  size_t live_;
+  size_t peak_live_;
+};
+
+struct MemoryPoolStats {
+  // Zero unless the pool counts them (PoolStats).
+  size_t allocations;
+  size_t deallocations;
+  size_t live_objects;
+  size_t peak_live_objects;
+
+  size_t blocks_held;
+  size_t bytes_held;
+  size_t padding_bytes;  // bytes held that can never store an object
+  size_t free_slots;     // length of the free list, including slots waiting for a scrub
+  std::chrono::steady_clock::time_point taken_at;
+};
+
+// Allocations per second between two snapshots of the same pool.
+inline double AllocationRate(const MemoryPoolStats &from, const MemoryPoolStats &to) {
+  double seconds = std::chrono::duration<double>(to.taken_at - from.taken_at).count();
+  return seconds > 0 ? (to.allocations - from.allocations) / seconds : 0;
+}
+
+inline double DeallocationRate(const MemoryPoolStats &from, const MemoryPoolStats &to) {
+  double seconds = std::chrono::duration<double>(to.taken_at - from.taken_at).count();
+  return seconds > 0 ? (to.deallocations - from.deallocations) / seconds : 0;
+}
+
+template <typename T, size_t BlockSize = 4096, class Scrub = ScrubNone, class Stats = NoPoolStats>
+class MemoryPool {
 public:
   /* Member types */
   typedef T value_type;
@@ -53,13 +239,14 @@ public:
   typedef std::true_type propagate_on_container_move_assignment;
   typedef std::true_type propagate_on_container_swap;
 
-  template <typename U> struct rebind { typedef MemoryPool<U> other; };
+  template <typename U> struct rebind { typedef MemoryPool<U, BlockSize, Scrub, Stats> other; };
 
   /* Member functions */
   MemoryPool() noexcept;
   MemoryPool(const MemoryPool &memoryPool) noexcept;
   MemoryPool(MemoryPool &&memoryPool) noexcept;
-  template <class U> MemoryPool(const MemoryPool<U> &memoryPool) noexcept;
+  template <class U>
+  MemoryPool(const MemoryPool<U, BlockSize, Scrub, Stats> &memoryPool) noexcept;
 
   ~MemoryPool() noexcept;
 
@@ -69,7 +256,7 @@ public:
   pointer address(reference x) const noexcept;
   const_pointer address(const_reference x) const noexcept;
 
-  // Can only allocate one object at a time. n and hint are ignored
+  // Serves one object per call from the slabs. hint is ignored.
   pointer allocate(size_type n = 1, const_pointer hint = 0);
   void deallocate(pointer p, size_type n = 1);
 
@@ -81,233 +268,561 @@ public:
   template <class... Args> pointer newElement(Args &&... args);
   void deleteElement(pointer p);
 
+  // Releases the blocks whose slots are all free, except the one being carved. Returns the number
+  // of bytes released.
+  size_type Trim();
+
+  // Trims automatically once `free_blocks` blocks worth of slots are free, 0 disables it.
+  void SetTrimThreshold(size_type free_blocks) noexcept;
+
+  // Applies to blocks allocated afterwards.
+  void EnableHugePages(bool enable) noexcept { huge_pages_ = enable; }
+
+  MemoryPoolCounters Counters() const noexcept;
+
+  // O(1), cheap enough to be polled periodically.
+  MemoryPoolStats Snapshot() const noexcept;
+
+  // Objects handed out and not released yet, walks every block.
+  std::vector<const_pointer> LiveObjects() const;
+
+  // Scrubs the slots released under ScrubDeferred and makes them available again, e.g. from an
+  // idle callback of the owning thread.
+  void ScrubPending();
+
+  static const size_type kHugePageSize = 2 * 1024 * 1024;
+
 private:
-  struct Element_ {
-    Element_ *pre;
-    Element_ *next;
+  union Slot_ {
+    typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type element;
+    Slot_ *next;
   };
 
   typedef char *data_pointer;
-  typedef Element_ element_type;
-  typedef Element_ *element_pointer;
-
-  element_pointer data_element_;
-  element_pointer free_element_;
-
-  std::recursive_mutex m_;
+  typedef Slot_ slot_type;
+  typedef Slot_ *slot_pointer;
+
+  // Blocks are chained through their first slot.
+  slot_pointer current_block_;
+  // Bump pointer into the newest block, [current_slot_, last_slot_) is untouched.
+  slot_pointer current_slot_;
+  slot_pointer last_slot_;
+  // Intrusive list of released slots.
+  slot_pointer free_slots_;
+  size_type free_count_;
+  // Released slots waiting for a deferred scrub.
+  slot_pointer dirty_slots_;
+  size_type dirty_count_;
+
+  // deallocate() calls Trim() when free_count_ reaches trim_at_, 0 when disabled.
+  size_type trim_threshold_;
+  size_type trim_at_;
+
+  bool huge_pages_;
+  MemoryPoolCounters counters_;
+  Stats stats_;
 
   size_type padPointer(data_pointer p, size_type align) const noexcept;
+  slot_pointer firstSlot(slot_pointer block) const noexcept;
+  size_type slotsPerBlock(slot_pointer block) const noexcept;
   void allocateBlock();
+  data_pointer mapBlock();
+  void unmapBlock(slot_pointer block) noexcept;
+  static size_type pageSize() noexcept;
+  static size_type mappedLength() noexcept;
+  void moveFrom(MemoryPool &memoryPool) noexcept;
 
-  static_assert(BlockSize >= 2 * sizeof(element_type), "BlockSize too small.");
+  static_assert(BlockSize >= 2 * sizeof(slot_type), "BlockSize too small.");
 };
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-inline typename MemoryPool<T, BlockSize, ZeroOnDeallocate>::size_type
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::padPointer(data_pointer p, size_type align) const
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+const typename MemoryPool<T, BlockSize, Scrub, Stats>::size_type
+    MemoryPool<T, BlockSize, Scrub, Stats>::kHugePageSize;
+
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline typename MemoryPool<T, BlockSize, Scrub, Stats>::size_type
+MemoryPool<T, BlockSize, Scrub, Stats>::padPointer(data_pointer p, size_type align) const
     noexcept {
   uintptr_t result = reinterpret_cast<uintptr_t>(p);
   return ((align - result) % align);
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::MemoryPool() noexcept {
-  data_element_ = nullptr;
-  free_element_ = nullptr;
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+MemoryPool<T, BlockSize, Scrub, Stats>::MemoryPool() noexcept {
+  current_block_ = nullptr;
+  current_slot_ = nullptr;
+  last_slot_ = nullptr;
+  free_slots_ = nullptr;
+  free_count_ = 0;
+  dirty_slots_ = nullptr;
+  dirty_count_ = 0;
+  trim_threshold_ = 0;
+  trim_at_ = 0;
+  huge_pages_ = false;
+  memset(&counters_, 0, sizeof(counters_));
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::MemoryPool(const MemoryPool &memoryPool) noexcept
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+MemoryPool<T, BlockSize, Scrub, Stats>::MemoryPool(const MemoryPool &memoryPool) noexcept
     : MemoryPool() {}
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::MemoryPool(MemoryPool &&memoryPool) noexcept {
-  std::lock_guard<std::recursive_mutex> lock(m_);
-
-  data_element_ = memoryPool.data_element_;
-  memoryPool.data_element_ = nullptr;
-  free_element_ = memoryPool.free_element_;
-  memoryPool.free_element_ = nullptr;
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+MemoryPool<T, BlockSize, Scrub, Stats>::MemoryPool(MemoryPool &&memoryPool) noexcept
+    : MemoryPool() {
+  moveFrom(memoryPool);
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
+template <typename T, size_t BlockSize, class Scrub, class Stats>
 template <class U>
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::MemoryPool(const MemoryPool<U> &memoryPool) noexcept
+MemoryPool<T, BlockSize, Scrub, Stats>::MemoryPool(
+    const MemoryPool<U, BlockSize, Scrub, Stats> &memoryPool) noexcept
     : MemoryPool() {}
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-MemoryPool<T, BlockSize, ZeroOnDeallocate> &
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::operator=(MemoryPool &&memoryPool) noexcept {
-  std::lock_guard<std::recursive_mutex> lock(m_);
-
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+MemoryPool<T, BlockSize, Scrub, Stats> &
+MemoryPool<T, BlockSize, Scrub, Stats>::operator=(MemoryPool &&memoryPool) noexcept {
   if (this != &memoryPool) {
-    std::swap(data_element_, memoryPool.data_element_);
-    std::swap(free_element_, memoryPool.free_element_);
+    MemoryPool tmp(std::move(*this));
+    moveFrom(memoryPool);
+    memoryPool.moveFrom(tmp);
   }
   return *this;
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::~MemoryPool() noexcept {
-  std::lock_guard<std::recursive_mutex> lock(m_);
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+void MemoryPool<T, BlockSize, Scrub, Stats>::moveFrom(MemoryPool &memoryPool) noexcept {
+  current_block_ = memoryPool.current_block_;
+  current_slot_ = memoryPool.current_slot_;
+  last_slot_ = memoryPool.last_slot_;
+  free_slots_ = memoryPool.free_slots_;
+  free_count_ = memoryPool.free_count_;
+  dirty_slots_ = memoryPool.dirty_slots_;
+  dirty_count_ = memoryPool.dirty_count_;
+  trim_threshold_ = memoryPool.trim_threshold_;
+  trim_at_ = memoryPool.trim_at_;
+  huge_pages_ = memoryPool.huge_pages_;
+  counters_ = memoryPool.counters_;
+  stats_ = memoryPool.stats_;
+
+  memoryPool.current_block_ = nullptr;
+  memoryPool.current_slot_ = nullptr;
+  memoryPool.last_slot_ = nullptr;
+  memoryPool.free_slots_ = nullptr;
+  memoryPool.free_count_ = 0;
+  memoryPool.dirty_slots_ = nullptr;
+  memoryPool.dirty_count_ = 0;
+  memset(&memoryPool.counters_, 0, sizeof(memoryPool.counters_));
+  memoryPool.stats_ = Stats();
+}
 
-  element_pointer curr = data_element_;
-  while (curr != nullptr) {
-    element_pointer prev = curr->next;
-    operator delete(reinterpret_cast<void *>(curr));
-    curr = prev;
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+MemoryPool<T, BlockSize, Scrub, Stats>::~MemoryPool() noexcept {
+  if (Stats::kEnabled && stats_.Live() != 0) {
+    std::vector<const_pointer> live = LiveObjects();
+    stats_.OnLeaks(this, std::vector<const void *>(live.begin(), live.end()), sizeof(value_type));
   }
 
-  curr = free_element_;
+  slot_pointer curr = current_block_;
   while (curr != nullptr) {
-    element_pointer prev = curr->next;
-    operator delete(reinterpret_cast<void *>(curr));
+    slot_pointer prev = curr->next;
+    unmapBlock(curr);
     curr = prev;
   }
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-inline typename MemoryPool<T, BlockSize, ZeroOnDeallocate>::pointer
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::address(reference x) const noexcept {
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline typename MemoryPool<T, BlockSize, Scrub, Stats>::pointer
+MemoryPool<T, BlockSize, Scrub, Stats>::address(reference x) const noexcept {
   return &x;
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-inline typename MemoryPool<T, BlockSize, ZeroOnDeallocate>::const_pointer
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::address(const_reference x) const noexcept {
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline typename MemoryPool<T, BlockSize, Scrub, Stats>::const_pointer
+MemoryPool<T, BlockSize, Scrub, Stats>::address(const_reference x) const noexcept {
   return &x;
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-void MemoryPool<T, BlockSize, ZeroOnDeallocate>::allocateBlock() {
-  // Allocate space for the new block and store a pointer to the previous one
-  data_pointer new_block = reinterpret_cast<data_pointer>(operator new(BlockSize));
-  element_pointer new_ele_pointer = reinterpret_cast<element_pointer>(new_block);
-  new_ele_pointer->pre = nullptr;
-  new_ele_pointer->next = nullptr;
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline typename MemoryPool<T, BlockSize, Scrub, Stats>::slot_pointer
+MemoryPool<T, BlockSize, Scrub, Stats>::firstSlot(slot_pointer block) const noexcept {
+  // Pad block body to satisfy the alignment requirements for elements
+  data_pointer body = reinterpret_cast<data_pointer>(block) + sizeof(slot_pointer);
+  size_type body_padding = padPointer(body, alignof(slot_type));
+  return reinterpret_cast<slot_pointer>(body + body_padding);
+}
 
-  if (data_element_) {
-    data_element_->pre = new_ele_pointer;
-  }
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline typename MemoryPool<T, BlockSize, Scrub, Stats>::size_type
+MemoryPool<T, BlockSize, Scrub, Stats>::slotsPerBlock(slot_pointer block) const noexcept {
+  size_type header = reinterpret_cast<data_pointer>(firstSlot(block)) -
+                     reinterpret_cast<data_pointer>(block);
+  return (BlockSize - header) / sizeof(slot_type);
+}
 
-  new_ele_pointer->next = data_element_;
-  data_element_ = new_ele_pointer;
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+typename MemoryPool<T, BlockSize, Scrub, Stats>::data_pointer
+MemoryPool<T, BlockSize, Scrub, Stats>::mapBlock() {
+  size_type mapped = mappedLength();
+  if (mapped == 0)
+    return reinterpret_cast<data_pointer>(operator new(BlockSize));
+
+  bool huge = huge_pages_ && BlockSize % kHugePageSize == 0;
+#ifdef AKALI_WIN
+  void *p = NULL;
+  if (huge) {
+    // Needs SeLockMemoryPrivilege, fall back to normal pages without it.
+    SIZE_T large_page = GetLargePageMinimum();
+    if (large_page != 0 && BlockSize % large_page == 0)
+      p = VirtualAlloc(NULL, BlockSize, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES,
+                       PAGE_READWRITE);
+    huge = (p != NULL);
+  }
+  if (p == NULL)
+    p = VirtualAlloc(NULL, mapped, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (p == NULL)
+    throw std::bad_alloc();
+#else
+  size_type length = huge ? BlockSize + kHugePageSize : mapped;
+  void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    throw std::bad_alloc();
+  if (huge) {
+    // Over-map, then cut the block on a huge page boundary.
+    data_pointer raw = reinterpret_cast<data_pointer>(p);
+    data_pointer aligned = raw + padPointer(raw, kHugePageSize);
+    if (aligned != raw)
+      munmap(raw, aligned - raw);
+    if (aligned + BlockSize != raw + length)
+      munmap(aligned + BlockSize, raw + length - (aligned + BlockSize));
+    p = aligned;
+#ifdef MADV_HUGEPAGE
+    huge = (madvise(p, BlockSize, MADV_HUGEPAGE) == 0);
+#else
+    huge = false;
+#endif
+  }
+#endif
+  if (huge)
+    counters_.huge_page_blocks++;
+  return reinterpret_cast<data_pointer>(p);
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-inline typename MemoryPool<T, BlockSize, ZeroOnDeallocate>::pointer
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::allocate(size_type n, const_pointer hint) {
-  std::lock_guard<std::recursive_mutex> lock(m_);
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+void MemoryPool<T, BlockSize, Scrub, Stats>::unmapBlock(slot_pointer block) noexcept {
+  size_type mapped = mappedLength();
+  if (mapped == 0) {
+    operator delete(reinterpret_cast<void *>(block));
+    return;
+  }
+#ifdef AKALI_WIN
+  VirtualFree(block, 0, MEM_RELEASE);
+#else
+  munmap(block, mapped);
+#endif
+}
 
-  if (free_element_ != nullptr) {
-    data_pointer body = reinterpret_cast<data_pointer>(
-        reinterpret_cast<data_pointer>(free_element_) + sizeof(element_type));
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+typename MemoryPool<T, BlockSize, Scrub, Stats>::size_type
+MemoryPool<T, BlockSize, Scrub, Stats>::pageSize() noexcept {
+#ifdef AKALI_WIN
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return si.dwPageSize;
+#else
+  static const size_type page_size = static_cast<size_type>(sysconf(_SC_PAGESIZE));
+  return page_size;
+#endif
+}
 
-    size_type bodyPadding = padPointer(body, alignof(element_type));
+// Length of the mapping backing a block, 0 when blocks come from the heap.
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+typename MemoryPool<T, BlockSize, Scrub, Stats>::size_type
+MemoryPool<T, BlockSize, Scrub, Stats>::mappedLength() noexcept {
+  size_type page = pageSize();
+  if (BlockSize < page)
+    return 0;
+  return (BlockSize + page - 1) / page * page;
+}
 
-    pointer result = reinterpret_cast<pointer>(reinterpret_cast<data_pointer>(body + bodyPadding));
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+void MemoryPool<T, BlockSize, Scrub, Stats>::allocateBlock() {
+  // Allocate space for the new block and store a pointer to the previous one
+  data_pointer new_block = mapBlock();
+  reinterpret_cast<slot_pointer>(new_block)->next = current_block_;
+  current_block_ = reinterpret_cast<slot_pointer>(new_block);
 
-    element_pointer tmp = free_element_;
+  current_slot_ = firstSlot(current_block_);
+  last_slot_ = reinterpret_cast<slot_pointer>(new_block + BlockSize - sizeof(slot_type) + 1);
 
-    free_element_ = free_element_->next;
+  counters_.blocks_held++;
+  counters_.bytes_held += BlockSize;
+}
 
-    if (free_element_)
-      free_element_->pre = nullptr;
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline typename MemoryPool<T, BlockSize, Scrub, Stats>::pointer
+MemoryPool<T, BlockSize, Scrub, Stats>::allocate(size_type n, const_pointer /*hint*/) {
+  if (n != 1)
+    return reinterpret_cast<pointer>(operator new(n * sizeof(value_type)));
 
-    tmp->next = data_element_;
-    if (data_element_)
-      data_element_->pre = tmp;
-    tmp->pre = nullptr;
-    data_element_ = tmp;
+  if (free_slots_ == nullptr && dirty_slots_ != nullptr)
+    ScrubPending();
 
+  if (free_slots_ != nullptr) {
+    pointer result = reinterpret_cast<pointer>(free_slots_);
+    free_slots_ = free_slots_->next;
+    free_count_--;
+    stats_.OnAllocate();
     return result;
   }
-  else {
+
+  if (current_slot_ >= last_slot_)
     allocateBlock();
 
-    data_pointer body = reinterpret_cast<data_pointer>(
-        reinterpret_cast<data_pointer>(data_element_) + sizeof(element_type));
+  stats_.OnAllocate();
+  return reinterpret_cast<pointer>(current_slot_++);
+}
 
-    size_type bodyPadding = padPointer(body, alignof(element_type));
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline void MemoryPool<T, BlockSize, Scrub, Stats>::deallocate(pointer p, size_type n) {
+  if (p == nullptr)
+    return;
 
-    pointer result = reinterpret_cast<pointer>(reinterpret_cast<data_pointer>(body + bodyPadding));
+  if (n != 1) {
+    operator delete(reinterpret_cast<void *>(p));
+    return;
+  }
 
-    return result;
+  stats_.OnDeallocate();
+  if (Scrub::kDeferred) {
+    reinterpret_cast<slot_pointer>(p)->next = dirty_slots_;
+    dirty_slots_ = reinterpret_cast<slot_pointer>(p);
+    if (++dirty_count_ >= Scrub::kBatchSize)
+      ScrubPending();
+    return;
   }
+
+  Scrub::Scrub(p, sizeof(slot_type));
+
+  reinterpret_cast<slot_pointer>(p)->next = free_slots_;
+  free_slots_ = reinterpret_cast<slot_pointer>(p);
+  free_count_++;
+
+  if (trim_at_ != 0 && free_count_ >= trim_at_)
+    Trim();
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-inline void MemoryPool<T, BlockSize, ZeroOnDeallocate>::deallocate(pointer p, size_type n) {
-  std::lock_guard<std::recursive_mutex> lock(m_);
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+void MemoryPool<T, BlockSize, Scrub, Stats>::ScrubPending() {
+  while (dirty_slots_ != nullptr) {
+    slot_pointer slot = dirty_slots_;
+    dirty_slots_ = slot->next;
+    Scrub::Scrub(slot, sizeof(slot_type));
 
-  if (p != nullptr) {
-    element_pointer ele_p =
-        reinterpret_cast<element_pointer>(reinterpret_cast<data_pointer>(p) - sizeof(element_type));
+    slot->next = free_slots_;
+    free_slots_ = slot;
+    free_count_++;
+  }
+  dirty_count_ = 0;
 
-    if (ZeroOnDeallocate) {
-      memset(reinterpret_cast<data_pointer>(p), 0, BlockSize - sizeof(element_type));
-    }
+  if (trim_at_ != 0 && free_count_ >= trim_at_)
+    Trim();
+}
 
-    if (ele_p->pre) {
-      ele_p->pre->next = ele_p->next;
-    }
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+typename MemoryPool<T, BlockSize, Scrub, Stats>::size_type
+MemoryPool<T, BlockSize, Scrub, Stats>::Trim() {
+  if (dirty_slots_ != nullptr) {
+    // Comes back here once the pending slots are on the free list.
+    size_type trim_at = trim_at_;
+    trim_at_ = 0;
+    ScrubPending();
+    trim_at_ = trim_at;
+  }
 
-    if (ele_p->next) {
-      ele_p->next->pre = ele_p->pre;
-    }
+  struct BlockInfo {
+    slot_pointer block;
+    size_type free;
+  };
 
-    if (ele_p->pre == nullptr) {
-      data_element_ = ele_p->next;
+  std::vector<BlockInfo> blocks;
+  for (slot_pointer b = current_block_; b != nullptr; b = b->next) {
+    BlockInfo info = {b, 0};
+    blocks.push_back(info);
+  }
+  std::sort(blocks.begin(), blocks.end(),
+            [](const BlockInfo &a, const BlockInfo &b) { return a.block < b.block; });
+
+  // Count the free slots of every block, a slot belongs to the last block starting before it.
+  auto owner = [&blocks](slot_pointer slot) {
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), slot,
+                               [](slot_pointer s, const BlockInfo &b) { return s < b.block; });
+    return it - 1;
+  };
+  for (slot_pointer s = free_slots_; s != nullptr; s = s->next)
+    owner(s)->free++;
+
+  size_type released = 0;
+  std::vector<bool> release(blocks.size(), false);
+  for (size_t i = 0; i < blocks.size(); i++) {
+    // The block being carved is kept, it is where the next allocations go anyway.
+    if (blocks[i].block != current_block_ && blocks[i].free == slotsPerBlock(blocks[i].block)) {
+      release[i] = true;
+      released++;
     }
+  }
 
-    ele_p->pre = nullptr;
-    if (free_element_) {
-      ele_p->next = free_element_;
-      free_element_->pre = ele_p;
+  if (released == 0) {
+    if (trim_threshold_ != 0)
+      trim_at_ = free_count_ + trim_threshold_;
+    return 0;
+  }
+
+  // Unlink the slots of the released blocks, keeping the order of the others.
+  slot_pointer *link = &free_slots_;
+  while (*link != nullptr) {
+    if (release[owner(*link) - blocks.begin()]) {
+      *link = (*link)->next;
+      free_count_--;
     }
     else {
-      ele_p->next = nullptr;
+      link = &(*link)->next;
     }
-    free_element_ = ele_p;
   }
+
+  // Rebuild the block chain, the current block stays at its head.
+  slot_pointer kept = nullptr;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (release[i] || blocks[i].block == current_block_)
+      continue;
+    blocks[i].block->next = kept;
+    kept = blocks[i].block;
+  }
+  current_block_->next = kept;
+
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (release[i])
+      unmapBlock(blocks[i].block);
+  }
+
+  counters_.trims++;
+  counters_.blocks_held -= released;
+  counters_.bytes_held -= released * BlockSize;
+  counters_.blocks_released += released;
+  counters_.bytes_released += released * BlockSize;
+  if (mappedLength() != 0)
+    counters_.bytes_unmapped += released * mappedLength();
+  else
+    counters_.bytes_freed += released * BlockSize;
+
+  if (trim_threshold_ != 0)
+    trim_at_ = free_count_ + trim_threshold_;
+  return released * BlockSize;
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-inline typename MemoryPool<T, BlockSize, ZeroOnDeallocate>::size_type
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::max_size() const noexcept {
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+void MemoryPool<T, BlockSize, Scrub, Stats>::SetTrimThreshold(size_type free_blocks) noexcept {
+  // Re-armed after every trim so that scattered free slots don't trigger it on each call.
+  trim_threshold_ = free_blocks * ((BlockSize - sizeof(slot_pointer)) / sizeof(slot_type));
+  trim_at_ = trim_threshold_ == 0 ? 0 : free_count_ + trim_threshold_;
+}
+
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+MemoryPoolCounters MemoryPool<T, BlockSize, Scrub, Stats>::Counters() const noexcept {
+  MemoryPoolCounters result = counters_;
+  result.free_slots = free_count_ + dirty_count_;
+  return result;
+}
+
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+MemoryPoolStats MemoryPool<T, BlockSize, Scrub, Stats>::Snapshot() const noexcept {
+  MemoryPoolStats result;
+  result.allocations = stats_.Allocations();
+  result.deallocations = stats_.Deallocations();
+  result.live_objects = stats_.Live();
+  result.peak_live_objects = stats_.PeakLive();
+  result.blocks_held = counters_.blocks_held;
+  result.bytes_held = counters_.bytes_held;
+  // Block header, alignment, the tail that can't fit a slot and the padding inside every slot.
+  result.padding_bytes = 0;
+  if (current_block_ != nullptr) {
+    size_type used = slotsPerBlock(current_block_) * sizeof(value_type);
+    result.padding_bytes = counters_.blocks_held * (BlockSize - used);
+  }
+  result.free_slots = free_count_ + dirty_count_;
+  result.taken_at = std::chrono::steady_clock::now();
+  return result;
+}
+
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+std::vector<typename MemoryPool<T, BlockSize, Scrub, Stats>::const_pointer>
+MemoryPool<T, BlockSize, Scrub, Stats>::LiveObjects() const {
+  std::vector<slot_pointer> idle;
+  for (slot_pointer s = free_slots_; s != nullptr; s = s->next)
+    idle.push_back(s);
+  for (slot_pointer s = dirty_slots_; s != nullptr; s = s->next)
+    idle.push_back(s);
+  std::sort(idle.begin(), idle.end());
+
+  std::vector<const_pointer> result;
+  for (slot_pointer b = current_block_; b != nullptr; b = b->next) {
+    slot_pointer first = firstSlot(b);
+    // Only the current block has slots that were never handed out.
+    slot_pointer end = b == current_block_ ? current_slot_ : first + slotsPerBlock(b);
+    for (slot_pointer s = first; s < end; s++) {
+      if (!std::binary_search(idle.begin(), idle.end(), s))
+        result.push_back(reinterpret_cast<const_pointer>(s));
+    }
+  }
+  return result;
+}
+
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline typename MemoryPool<T, BlockSize, Scrub, Stats>::size_type
+MemoryPool<T, BlockSize, Scrub, Stats>::max_size() const noexcept {
   size_type maxBlocks = -1 / BlockSize;
-  return (BlockSize - sizeof(data_pointer)) / sizeof(element_type) * maxBlocks;
+  return (BlockSize - sizeof(data_pointer)) / sizeof(slot_type) * maxBlocks;
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
+template <typename T, size_t BlockSize, class Scrub, class Stats>
 template <class U, class... Args>
-inline void MemoryPool<T, BlockSize, ZeroOnDeallocate>::construct(U *p, Args &&... args) {
+inline void MemoryPool<T, BlockSize, Scrub, Stats>::construct(U *p, Args &&... args) {
   new (p) U(std::forward<Args>(args)...);
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
+template <typename T, size_t BlockSize, class Scrub, class Stats>
 template <class U>
-inline void MemoryPool<T, BlockSize, ZeroOnDeallocate>::destroy(U *p) {
+inline void MemoryPool<T, BlockSize, Scrub, Stats>::destroy(U *p) {
   p->~U();
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
+template <typename T, size_t BlockSize, class Scrub, class Stats>
 template <class... Args>
-inline typename MemoryPool<T, BlockSize, ZeroOnDeallocate>::pointer
-MemoryPool<T, BlockSize, ZeroOnDeallocate>::newElement(Args &&... args) {
-  std::lock_guard<std::recursive_mutex> lock(m_);
+inline typename MemoryPool<T, BlockSize, Scrub, Stats>::pointer
+MemoryPool<T, BlockSize, Scrub, Stats>::newElement(Args &&... args) {
   pointer result = allocate();
   construct<value_type>(result, std::forward<Args>(args)...);
   return result;
 }
 
-template <typename T, size_t BlockSize, bool ZeroOnDeallocate>
-inline void MemoryPool<T, BlockSize, ZeroOnDeallocate>::deleteElement(pointer p) {
-  std::lock_guard<std::recursive_mutex> lock(m_);
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline void MemoryPool<T, BlockSize, Scrub, Stats>::deleteElement(pointer p) {
   if (p != nullptr) {
     p->~value_type();
     deallocate(p);
   }
 }
+
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline bool operator==(const MemoryPool<T, BlockSize, Scrub, Stats> &a,
+                       const MemoryPool<T, BlockSize, Scrub, Stats> &b) noexcept {
+  // Memory can only be returned to the pool that handed it out.
+  return &a == &b;
+}
+
+template <typename T, size_t BlockSize, class Scrub, class Stats>
+inline bool operator!=(const MemoryPool<T, BlockSize, Scrub, Stats> &a,
+                       const MemoryPool<T, BlockSize, Scrub, Stats> &b) noexcept {
+  return !(a == b);
+}
 } // namespace akali
 #endif // AKALI_MEMORY_POOL_H_
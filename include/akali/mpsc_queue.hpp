@@ -0,0 +1,98 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_MPSC_QUEUE_H_
+#define AKALI_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include "akali/akali_export.h"
+#include "akali/concurrent_memory_pool.hpp"
+#include "akali/constructormagic.h"
+
+/*
+MpscQueue is Dmitry Vyukov's unbounded multi-producer single-consumer queue, a list linked through
+nodes from a ConcurrentMemoryPool.
+
+Any thread may Push(): one atomic exchange on the head and a store, no lock and no CAS loop. Only
+the consumer may Pop() and Empty(). The list always starts with a dummy node, a popped node
+becomes the new dummy, so producers and the consumer never touch the same node except when the
+queue is empty.
+
+A producer that was preempted between its exchange and its store hides the items pushed after
+it: Pop() then returns false although Empty() is false, the consumer should retry shortly.
+
+T must be default constructible (the first dummy) and movable.
+*/
+
+namespace akali {
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue() {
+    Node* stub = nodes_.newElement();
+    head_.store(stub, std::memory_order_relaxed);
+    tail_ = stub;
+  }
+
+  ~MpscQueue() {
+    T item;
+    while (Pop(&item)) {
+    }
+    nodes_.deleteElement(tail_);
+  }
+
+  // Any thread.
+  void Push(T&& item) {
+    Node* node = nodes_.newElement(std::move(item));
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Consumer only.
+  bool Pop(T* item) {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+      return false;
+    *item = std::move(next->item);
+    tail_ = next;
+    nodes_.deleteElement(tail);
+    return true;
+  }
+
+  // Consumer only, false as soon as a push has started.
+  bool Empty() const { return head_.load(std::memory_order_acquire) == tail_; }
+
+ private:
+  struct Node {
+    Node() : next(nullptr) {}
+    explicit Node(T&& t) : next(nullptr), item(std::move(t)) {}
+
+    std::atomic<Node*> next;
+    T item;
+  };
+
+  // head_ is written by the producers, tail_ by the consumer, keep them on different cache lines.
+  std::atomic<Node*> head_;
+  char padding0_[64 - sizeof(std::atomic<Node*>)];
+  Node* tail_;
+  char padding1_[64 - sizeof(Node*)];
+  ConcurrentMemoryPool<Node> nodes_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+}  // namespace akali
+#endif  // AKALI_MPSC_QUEUE_H_
@@ -0,0 +1,173 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_OBJECT_POOL_H_
+#define AKALI_OBJECT_POOL_H_
+
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "akali/akali_export.h"
+#include "akali/constructormagic.h"
+#include "akali/memory_pool.hpp"
+
+/*
+ObjectPool keeps released objects alive and hands them out again, so heavy objects (e.g. per
+connection contexts holding vectors and strings) keep the capacity they have grown.
+
+Acquire() returns a move-only PooledPtr<T>, the object goes back to the pool when the handle is
+destroyed. On release the object is reset instead of destroyed, using the hook given to
+SetResetHook(), or `void T::Reset()` when T has one. Without either there is no safe way to
+recycle an object, so it is destroyed as usual. At most `max_idle` objects are kept, the others
+are destroyed. Objects are constructed in a MemoryPool.
+
+The pool must outlive its handles. This is **NOT** thread safe.
+*/
+
+namespace akali {
+template <typename T>
+class ObjectRecycler {
+ public:
+  virtual void Recycle(T* p) = 0;
+
+ protected:
+  virtual ~ObjectRecycler() {}
+};
+
+template <typename T>
+class PooledPtr {
+ public:
+  PooledPtr() noexcept : p_(nullptr), recycler_(nullptr) {}
+  PooledPtr(T* p, ObjectRecycler<T>* recycler) noexcept : p_(p), recycler_(recycler) {}
+  PooledPtr(PooledPtr&& other) noexcept : p_(other.p_), recycler_(other.recycler_) {
+    other.p_ = nullptr;
+    other.recycler_ = nullptr;
+  }
+  ~PooledPtr() { reset(); }
+
+  PooledPtr& operator=(PooledPtr&& other) noexcept {
+    if (this != &other) {
+      reset();
+      std::swap(p_, other.p_);
+      std::swap(recycler_, other.recycler_);
+    }
+    return *this;
+  }
+
+  // Gives the object back to its pool.
+  void reset() {
+    if (p_) {
+      recycler_->Recycle(p_);
+      p_ = nullptr;
+      recycler_ = nullptr;
+    }
+  }
+
+  T* get() const noexcept { return p_; }
+  T& operator*() const noexcept { return *p_; }
+  T* operator->() const noexcept { return p_; }
+  explicit operator bool() const noexcept { return p_ != nullptr; }
+
+ private:
+  T* p_;
+  ObjectRecycler<T>* recycler_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(PooledPtr);
+};
+
+template <typename T, size_t BlockSize = 4096>
+class ObjectPool : public ObjectRecycler<T> {
+ public:
+  typedef std::function<void(T&)> ResetHook;
+
+  explicit ObjectPool(size_t max_idle = 64) : max_idle_(max_idle), live_(0) {}
+
+  ~ObjectPool() { Clear(); }
+
+  // Hands out an idle object if there is one, `args` are only used to construct a new one.
+  template <class... Args>
+  PooledPtr<T> Acquire(Args&&... args) {
+    T* p = nullptr;
+    if (!idle_.empty()) {
+      p = idle_.back();
+      idle_.pop_back();
+    }
+    else {
+      p = pool_.newElement(std::forward<Args>(args)...);
+    }
+    live_++;
+    return PooledPtr<T>(p, this);
+  }
+
+  void SetResetHook(ResetHook hook) { reset_hook_ = std::move(hook); }
+
+  void SetMaxIdle(size_t max_idle) {
+    max_idle_ = max_idle;
+    while (idle_.size() > max_idle_) {
+      pool_.deleteElement(idle_.back());
+      idle_.pop_back();
+    }
+  }
+
+  // Destroys the idle objects.
+  void Clear() {
+    for (T* p : idle_)
+      pool_.deleteElement(p);
+    idle_.clear();
+  }
+
+  size_t IdleCount() const { return idle_.size(); }
+  size_t LiveCount() const { return live_; }
+  size_t MaxIdle() const { return max_idle_; }
+
+ protected:
+  void Recycle(T* p) override {
+    live_--;
+    if (idle_.size() < max_idle_ && (reset_hook_ || kHasReset)) {
+      if (reset_hook_)
+        reset_hook_(*p);
+      else
+        CallReset(p, std::integral_constant<bool, kHasReset>());
+      idle_.push_back(p);
+      return;
+    }
+    pool_.deleteElement(p);
+  }
+
+ private:
+  template <typename U>
+  static auto DetectReset(int) -> decltype(std::declval<U&>().Reset(), std::true_type());
+  template <typename U>
+  static std::false_type DetectReset(...);
+
+  static const bool kHasReset = decltype(DetectReset<T>(0))::value;
+
+  static void CallReset(T* p, std::true_type) { p->Reset(); }
+  static void CallReset(T*, std::false_type) {}
+
+  MemoryPool<T, BlockSize, ScrubNone> pool_;
+  std::vector<T*> idle_;
+  size_t max_idle_;
+  size_t live_;
+  ResetHook reset_hook_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(ObjectPool);
+};
+
+template <typename T, size_t BlockSize>
+const bool ObjectPool<T, BlockSize>::kHasReset;
+}  // namespace akali
+#endif  // AKALI_OBJECT_POOL_H_
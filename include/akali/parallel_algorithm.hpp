@@ -0,0 +1,342 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_PARALLEL_ALGORITHM_H_
+#define AKALI_PARALLEL_ALGORITHM_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <numeric>
+#include <vector>
+#include "akali/akali_export.h"
+#include "akali/thread_pool.hpp"
+
+/*
+Parallel versions of some <algorithm> and <numeric> functions, for C++11 code that has no
+std::execution::par. They take random access iterators and run on the given ThreadPool, the calling
+thread takes part (see ThreadPool::parallel_for()).
+
+Ranges shorter than kSerialCutoff elements are handled by the std algorithm on the calling thread.
+Longer ones are cut into chunks of at least kMinChunkBytes of input, so that a chunk covers whole
+cache lines and the per-chunk overhead stays small next to the work; the two-pass algorithms
+(inclusive_scan, copy_if) use a few contiguous blocks per participant instead.
+
+- for_each, transform: independent chunks.
+- reduce: op must be associative and commutative, as for std::reduce.
+- inclusive_scan: sums the blocks, scans the block sums, then scans every block from its offset.
+  op must be associative. first may equal d_first.
+- copy_if: marks and counts the elements per block, then copies every block to its offset, so the
+  output keeps the input order. Uses one byte per element of scratch memory.
+- find_if: returns the first match like std::find_if, chunks past a known match are skipped.
+- sort: a merge sort. Every block is sorted with std::sort, then runs are merged pairwise, every
+  merge split into pieces along the merge path so that all rounds keep every participant busy.
+  Not stable. Needs a buffer of n default constructible elements.
+*/
+
+namespace akali {
+namespace parallel {
+enum : size_t { kSerialCutoff = 1 << 14, kMinChunkBytes = 16 * 1024 };
+
+namespace internal {
+template <class It>
+size_t Grain() {
+  typedef typename std::iterator_traits<It>::value_type T;
+  return std::max<size_t>(kMinChunkBytes / sizeof(T), 1);
+}
+
+// A few blocks per participant, none smaller than a chunk.
+template <class It>
+size_t BlockCount(ThreadPool& pool, size_t n) {
+  size_t blocks = std::min((n + Grain<It>() - 1) / Grain<It>(), 4 * (pool.size() + 1));
+  return std::max<size_t>(blocks, 1);
+}
+
+// Start of block b when [0, n) is cut into `blocks` nearly equal blocks.
+inline size_t BlockBegin(size_t n, size_t blocks, size_t b) {
+  return b * (n / blocks) + std::min(b, n % blocks);
+}
+
+// Number of elements of a[0, m) among the first d elements of merge(a, b), ties taken from a.
+template <class It, class Compare>
+size_t CoRank(It a, size_t m, It b, size_t k, size_t d, Compare& comp) {
+  size_t lo = d > k ? d - k : 0;
+  size_t hi = std::min(d, m);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (!comp(b[d - mid - 1], a[mid]))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Merges the runs of `width` blocks of src pairwise into dst.
+template <class In, class Out, class Compare>
+void MergeRuns(ThreadPool& pool,
+               In src,
+               Out dst,
+               size_t n,
+               size_t blocks,
+               size_t width,
+               Compare& comp) {
+  size_t pairs = blocks / (2 * width);
+  size_t pieces = std::max<size_t>(1, 2 * (pool.size() + 1) / pairs);
+
+  // Split every merge first, the merges move elements out of src.
+  std::vector<size_t> splits(pairs * (pieces + 1));
+  for (size_t p = 0; p < pairs; p++) {
+    size_t lo = BlockBegin(n, blocks, 2 * p * width);
+    size_t mid = BlockBegin(n, blocks, (2 * p + 1) * width);
+    size_t hi = BlockBegin(n, blocks, (2 * p + 2) * width);
+    for (size_t piece = 0; piece <= pieces; piece++) {
+      size_t d = (hi - lo) * piece / pieces;
+      splits[p * (pieces + 1) + piece] = CoRank(src + lo, mid - lo, src + mid, hi - mid, d, comp);
+    }
+  }
+
+  pool.parallel_for(size_t(0), pairs * pieces, size_t(1), [&](size_t t) {
+    size_t p = t / pieces;
+    size_t piece = t % pieces;
+    size_t lo = BlockBegin(n, blocks, 2 * p * width);
+    size_t mid = BlockBegin(n, blocks, (2 * p + 1) * width);
+    size_t hi = BlockBegin(n, blocks, (2 * p + 2) * width);
+    size_t d0 = (hi - lo) * piece / pieces;
+    size_t d1 = (hi - lo) * (piece + 1) / pieces;
+    size_t i0 = splits[p * (pieces + 1) + piece];
+    size_t i1 = splits[p * (pieces + 1) + piece + 1];
+    std::merge(std::make_move_iterator(src + lo + i0), std::make_move_iterator(src + lo + i1),
+               std::make_move_iterator(src + mid + (d0 - i0)),
+               std::make_move_iterator(src + mid + (d1 - i1)), dst + lo + d0, comp);
+  });
+}
+}  // namespace internal
+
+template <class RandomIt, class UnaryFunction>
+void for_each(ThreadPool& pool, RandomIt first, RandomIt last, UnaryFunction f) {
+  size_t n = static_cast<size_t>(last - first);
+  if (n < kSerialCutoff) {
+    std::for_each(first, last, f);
+    return;
+  }
+  pool.parallel_for_chunks(size_t(0), n, internal::Grain<RandomIt>(),
+                           [first, &f](size_t b, size_t e) { std::for_each(first + b, first + e, f); });
+}
+
+template <class RandomIt1, class RandomIt2, class UnaryOperation>
+RandomIt2 transform(ThreadPool& pool,
+                    RandomIt1 first,
+                    RandomIt1 last,
+                    RandomIt2 d_first,
+                    UnaryOperation op) {
+  size_t n = static_cast<size_t>(last - first);
+  if (n < kSerialCutoff)
+    return std::transform(first, last, d_first, op);
+  pool.parallel_for_chunks(size_t(0), n, internal::Grain<RandomIt1>(),
+                           [first, d_first, &op](size_t b, size_t e) {
+                             std::transform(first + b, first + e, d_first + b, op);
+                           });
+  return d_first + n;
+}
+
+template <class RandomIt1, class RandomIt2, class RandomIt3, class BinaryOperation>
+RandomIt3 transform(ThreadPool& pool,
+                    RandomIt1 first1,
+                    RandomIt1 last1,
+                    RandomIt2 first2,
+                    RandomIt3 d_first,
+                    BinaryOperation op) {
+  size_t n = static_cast<size_t>(last1 - first1);
+  if (n < kSerialCutoff)
+    return std::transform(first1, last1, first2, d_first, op);
+  pool.parallel_for_chunks(size_t(0), n, internal::Grain<RandomIt1>(),
+                           [first1, first2, d_first, &op](size_t b, size_t e) {
+                             std::transform(first1 + b, first1 + e, first2 + b, d_first + b, op);
+                           });
+  return d_first + n;
+}
+
+template <class RandomIt, class T, class BinaryOp>
+T reduce(ThreadPool& pool, RandomIt first, RandomIt last, T init, BinaryOp op) {
+  size_t n = static_cast<size_t>(last - first);
+  if (n < kSerialCutoff)
+    return std::accumulate(first, last, init, op);
+
+  T result = init;
+  std::mutex result_mutex;
+  pool.parallel_for_chunks(size_t(0), n, internal::Grain<RandomIt>(), [&](size_t b, size_t e) {
+    T partial = first[b];
+    for (size_t i = b + 1; i < e; i++)
+      partial = op(partial, first[i]);
+    std::lock_guard<std::mutex> lock(result_mutex);
+    result = op(result, partial);
+  });
+  return result;
+}
+
+template <class RandomIt, class T>
+T reduce(ThreadPool& pool, RandomIt first, RandomIt last, T init) {
+  return parallel::reduce(pool, first, last, init, std::plus<T>());
+}
+
+template <class RandomIt1, class RandomIt2, class BinaryOp>
+RandomIt2 inclusive_scan(ThreadPool& pool,
+                         RandomIt1 first,
+                         RandomIt1 last,
+                         RandomIt2 d_first,
+                         BinaryOp op) {
+  typedef typename std::iterator_traits<RandomIt1>::value_type T;
+  size_t n = static_cast<size_t>(last - first);
+  if (n < kSerialCutoff)
+    return std::partial_sum(first, last, d_first, op);
+
+  size_t blocks = internal::BlockCount<RandomIt1>(pool, n);
+  std::vector<T> sums(blocks, first[0]);
+  pool.parallel_for(size_t(0), blocks - 1, size_t(1), [&](size_t block) {
+    size_t b = internal::BlockBegin(n, blocks, block);
+    size_t e = internal::BlockBegin(n, blocks, block + 1);
+    T sum = first[b];
+    for (size_t i = b + 1; i < e; i++)
+      sum = op(sum, first[i]);
+    sums[block] = sum;
+  });
+  for (size_t block = 1; block + 1 < blocks; block++)
+    sums[block] = op(sums[block - 1], sums[block]);
+
+  pool.parallel_for(size_t(0), blocks, size_t(1), [&](size_t block) {
+    size_t b = internal::BlockBegin(n, blocks, block);
+    size_t e = internal::BlockBegin(n, blocks, block + 1);
+    T sum = block == 0 ? T(first[b]) : op(sums[block - 1], first[b]);
+    d_first[b] = sum;
+    for (size_t i = b + 1; i < e; i++) {
+      sum = op(sum, first[i]);
+      d_first[i] = sum;
+    }
+  });
+  return d_first + n;
+}
+
+template <class RandomIt1, class RandomIt2>
+RandomIt2 inclusive_scan(ThreadPool& pool, RandomIt1 first, RandomIt1 last, RandomIt2 d_first) {
+  typedef typename std::iterator_traits<RandomIt1>::value_type T;
+  return parallel::inclusive_scan(pool, first, last, d_first, std::plus<T>());
+}
+
+template <class RandomIt1, class RandomIt2, class UnaryPredicate>
+RandomIt2 copy_if(ThreadPool& pool,
+                  RandomIt1 first,
+                  RandomIt1 last,
+                  RandomIt2 d_first,
+                  UnaryPredicate pred) {
+  size_t n = static_cast<size_t>(last - first);
+  if (n < kSerialCutoff)
+    return std::copy_if(first, last, d_first, pred);
+
+  size_t blocks = internal::BlockCount<RandomIt1>(pool, n);
+  std::vector<char> keep(n);
+  std::vector<size_t> offsets(blocks + 1, 0);
+  pool.parallel_for(size_t(0), blocks, size_t(1), [&](size_t block) {
+    size_t b = internal::BlockBegin(n, blocks, block);
+    size_t e = internal::BlockBegin(n, blocks, block + 1);
+    size_t count = 0;
+    for (size_t i = b; i < e; i++) {
+      keep[i] = pred(first[i]) ? 1 : 0;
+      count += keep[i];
+    }
+    offsets[block + 1] = count;
+  });
+  for (size_t block = 1; block <= blocks; block++)
+    offsets[block] += offsets[block - 1];
+
+  pool.parallel_for(size_t(0), blocks, size_t(1), [&](size_t block) {
+    size_t b = internal::BlockBegin(n, blocks, block);
+    size_t e = internal::BlockBegin(n, blocks, block + 1);
+    RandomIt2 out = d_first + offsets[block];
+    for (size_t i = b; i < e; i++) {
+      if (keep[i])
+        *out++ = first[i];
+    }
+  });
+  return d_first + offsets[blocks];
+}
+
+template <class RandomIt, class UnaryPredicate>
+RandomIt find_if(ThreadPool& pool, RandomIt first, RandomIt last, UnaryPredicate pred) {
+  size_t n = static_cast<size_t>(last - first);
+  if (n < kSerialCutoff)
+    return std::find_if(first, last, pred);
+
+  std::atomic<size_t> found(n);
+  pool.parallel_for_chunks(size_t(0), n, internal::Grain<RandomIt>(), [&](size_t b, size_t e) {
+    for (size_t i = b; i < e && i < found.load(std::memory_order_relaxed); i++) {
+      if (pred(first[i])) {
+        size_t current = found.load(std::memory_order_relaxed);
+        while (i < current && !found.compare_exchange_weak(current, i))
+          ;
+        return;
+      }
+    }
+  });
+  return first + found.load();
+}
+
+template <class RandomIt, class Compare>
+void sort(ThreadPool& pool, RandomIt first, RandomIt last, Compare comp) {
+  typedef typename std::iterator_traits<RandomIt>::value_type T;
+  size_t n = static_cast<size_t>(last - first);
+
+  // A power of two of blocks, about two per participant.
+  size_t blocks = 1;
+  while (blocks < 2 * (pool.size() + 1) && n / (2 * blocks) >= kSerialCutoff)
+    blocks *= 2;
+  if (blocks == 1) {
+    std::sort(first, last, comp);
+    return;
+  }
+
+  pool.parallel_for(size_t(0), blocks, size_t(1), [&](size_t block) {
+    std::sort(first + internal::BlockBegin(n, blocks, block),
+              first + internal::BlockBegin(n, blocks, block + 1), comp);
+  });
+
+  std::vector<T> buffer(n);
+  bool in_buffer = false;
+  for (size_t width = 1; width < blocks; width *= 2) {
+    if (in_buffer)
+      internal::MergeRuns(pool, buffer.begin(), first, n, blocks, width, comp);
+    else
+      internal::MergeRuns(pool, first, buffer.begin(), n, blocks, width, comp);
+    in_buffer = !in_buffer;
+  }
+  if (in_buffer) {
+    typename std::vector<T>::iterator from = buffer.begin();
+    pool.parallel_for_chunks(size_t(0), n, internal::Grain<RandomIt>(),
+                             [from, first](size_t b, size_t e) {
+                               std::move(from + b, from + e, first + b);
+                             });
+  }
+}
+
+template <class RandomIt>
+void sort(ThreadPool& pool, RandomIt first, RandomIt last) {
+  typedef typename std::iterator_traits<RandomIt>::value_type T;
+  parallel::sort(pool, first, last, std::less<T>());
+}
+}  // namespace parallel
+}  // namespace akali
+#endif  // AKALI_PARALLEL_ALGORITHM_H_
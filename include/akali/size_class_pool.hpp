@@ -0,0 +1,290 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_SIZE_CLASS_POOL_H_
+#define AKALI_SIZE_CLASS_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "akali/akali_export.h"
+#include "akali/constructormagic.h"
+
+#ifdef AKALI_WIN
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+SizeClassPool is a general purpose pool for variable-size buffers.
+
+Requests up to kMaxSmallSize bytes are rounded up to a size class and served by the slab of that
+class. Classes are spaced 16 bytes apart up to 128 bytes, then every power-of-two range is split
+into four (160, 192, 224, 256, 320, ...), so no more than 25% of a slot is wasted. Larger requests
+are mapped directly from the system (mmap/VirtualAlloc) and unmapped on release.
+
+Deallocate must be given the size that was passed to Allocate, like sized operator delete. Every
+slab has its own lock, so the pool can be shared by threads.
+
+SizeClassAllocator<T> adapts a pool (by default SizeClassPool::Default()) to the std allocator
+interface, e.g. for std::vector<char> or std::basic_string payload buffers.
+*/
+
+namespace akali {
+class SizeClassPool {
+ public:
+  enum : size_t {
+    kAlignment = 16,
+    kMaxSmallSize = 64 * 1024,
+    kClassCount = 44,
+  };
+
+  SizeClassPool() {
+    for (size_t i = 0; i < kClassCount; i++)
+      slabs_[i].Init(ClassSize(i));
+  }
+
+  ~SizeClassPool() {}
+
+  // Process wide pool, never destroyed so that static containers can still release into it.
+  static SizeClassPool& Default() {
+    static SizeClassPool* pool = new SizeClassPool();
+    return *pool;
+  }
+
+  void* Allocate(size_t size) {
+    if (size > kMaxSmallSize)
+      return AllocateLarge(size);
+    return slabs_[ClassIndex(size)].Allocate();
+  }
+
+  void Deallocate(void* p, size_t size) {
+    if (p == nullptr)
+      return;
+    if (size > kMaxSmallSize) {
+      DeallocateLarge(p, size);
+      return;
+    }
+    slabs_[ClassIndex(size)].Deallocate(p);
+  }
+
+  // Number of bytes actually reserved for a request of `size` bytes.
+  static size_t AllocationSize(size_t size) {
+    if (size > kMaxSmallSize)
+      return RoundUp(size, PageSize());
+    return ClassSize(ClassIndex(size));
+  }
+
+  static size_t ClassIndex(size_t size) {
+    if (size <= 128)
+      return size == 0 ? 0 : (size - 1) / 16;
+
+    // size is in (2^k, 2^(k+1)], which is split into four classes of 2^(k-2) bytes.
+    size_t k = 7;
+    while ((size_t(1) << (k + 1)) < size)
+      k++;
+    return 8 + (k - 7) * 4 + ((size - 1 - (size_t(1) << k)) >> (k - 2));
+  }
+
+  static size_t ClassSize(size_t index) {
+    if (index < 8)
+      return (index + 1) * 16;
+    size_t k = 7 + (index - 8) / 4;
+    return (size_t(1) << k) + ((index - 8) % 4 + 1) * (size_t(1) << (k - 2));
+  }
+
+ private:
+  class Slab {
+   public:
+    Slab()
+        : slot_size_(0)
+        , block_size_(0)
+        , blocks_(nullptr)
+        , free_(nullptr)
+        , cur_(nullptr)
+        , end_(nullptr) {}
+
+    ~Slab() {
+      while (blocks_) {
+        Block* next = blocks_->next;
+        operator delete(reinterpret_cast<void*>(blocks_));
+        blocks_ = next;
+      }
+    }
+
+    void Init(size_t slot_size) {
+      slot_size_ = slot_size;
+      block_size_ = sizeof(Block) + slot_size * 8;
+      if (block_size_ < 64 * 1024)
+        block_size_ = 64 * 1024;
+    }
+
+    void* Allocate() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (free_) {
+        FreeSlot* result = free_;
+        free_ = free_->next;
+        return result;
+      }
+
+      if (cur_ + slot_size_ > end_) {
+        char* block = reinterpret_cast<char*>(operator new(block_size_));
+        reinterpret_cast<Block*>(block)->next = blocks_;
+        blocks_ = reinterpret_cast<Block*>(block);
+        cur_ = block + sizeof(Block);
+        end_ = block + block_size_;
+      }
+      void* result = cur_;
+      cur_ += slot_size_;
+      return result;
+    }
+
+    void Deallocate(void* p) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      FreeSlot* slot = reinterpret_cast<FreeSlot*>(p);
+      slot->next = free_;
+      free_ = slot;
+    }
+
+   private:
+    // Keeps the first slot of a block aligned to kAlignment.
+    struct Block {
+      Block* next;
+      char padding[kAlignment - sizeof(Block*)];
+    };
+    struct FreeSlot {
+      FreeSlot* next;
+    };
+
+    std::mutex mutex_;
+    size_t slot_size_;
+    size_t block_size_;
+    Block* blocks_;
+    FreeSlot* free_;
+    char* cur_;
+    char* end_;
+
+    AKALI_DISALLOW_COPY_AND_ASSIGN(Slab);
+  };
+
+  static size_t RoundUp(size_t size, size_t align) { return (size + align - 1) / align * align; }
+
+  static size_t PageSize() {
+#ifdef AKALI_WIN
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwPageSize;
+#else
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page_size;
+#endif
+  }
+
+  static void* AllocateLarge(size_t size) {
+    size = RoundUp(size, PageSize());
+#ifdef AKALI_WIN
+    void* p = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (p == NULL)
+      throw std::bad_alloc();
+#else
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      throw std::bad_alloc();
+#endif
+    return p;
+  }
+
+  static void DeallocateLarge(void* p, size_t size) {
+#ifdef AKALI_WIN
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, RoundUp(size, PageSize()));
+#endif
+  }
+
+  Slab slabs_[kClassCount];
+
+  static_assert(kAlignment >= sizeof(void*), "kAlignment too small.");
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(SizeClassPool);
+};
+
+template <typename T>
+class SizeClassAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef T& reference;
+  typedef const T* const_pointer;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  template <typename U>
+  struct rebind {
+    typedef SizeClassAllocator<U> other;
+  };
+
+  SizeClassAllocator() noexcept : pool_(&SizeClassPool::Default()) {}
+  explicit SizeClassAllocator(SizeClassPool* pool) noexcept : pool_(pool) {}
+  template <class U>
+  SizeClassAllocator(const SizeClassAllocator<U>& other) noexcept : pool_(other.pool()) {}
+
+  pointer allocate(size_type n, const void* = 0) {
+    return static_cast<pointer>(pool_->Allocate(n * sizeof(value_type)));
+  }
+
+  void deallocate(pointer p, size_type n) { pool_->Deallocate(p, n * sizeof(value_type)); }
+
+  size_type max_size() const noexcept { return size_type(-1) / sizeof(value_type); }
+
+  template <class U, class... Args>
+  void construct(U* p, Args&&... args) {
+    new (p) U(std::forward<Args>(args)...);
+  }
+  template <class U>
+  void destroy(U* p) {
+    p->~U();
+  }
+
+  SizeClassPool* pool() const noexcept { return pool_; }
+
+ private:
+  SizeClassPool* pool_;
+
+  static_assert(alignof(T) <= SizeClassPool::kAlignment, "Alignment not supported.");
+};
+
+template <typename T, typename U>
+inline bool operator==(const SizeClassAllocator<T>& a, const SizeClassAllocator<U>& b) noexcept {
+  return a.pool() == b.pool();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const SizeClassAllocator<T>& a, const SizeClassAllocator<U>& b) noexcept {
+  return !(a == b);
+}
+}  // namespace akali
+#endif  // AKALI_SIZE_CLASS_POOL_H_
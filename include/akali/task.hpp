@@ -0,0 +1,266 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_TASK_H_
+#define AKALI_TASK_H_
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "akali/akali_export.h"
+#include "akali/constructormagic.h"
+#include "akali/size_class_pool.hpp"
+
+/*
+Task is a move-only `void()` callable, the task type of ThreadPool and Thread.
+
+Unlike std::function it doesn't need a copyable target, so a task can own a std::promise or a
+std::unique_ptr. Targets of up to kInlineSize bytes that are nothrow movable are stored inside
+the Task, bigger ones go to the heap. A lambda capturing a few pointers or a std::bind of a
+function and a couple of arguments are stored inline.
+
+MakeFutureTask() wraps a callable into a Task that fulfils a promise, the promise's shared state
+is allocated from SizeClassPool::Default() instead of the heap.
+*/
+
+namespace akali {
+class Task {
+ public:
+  enum : size_t { kInlineSize = 48 };
+
+  Task() noexcept : ops_(nullptr) {}
+
+  template <class F,
+            class = typename std::enable_if<
+                !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+  Task(F&& f) : ops_(nullptr) {
+    typedef typename std::decay<F>::type Target;
+    Store<Target>(std::forward<F>(f), Inline<Target>());
+  }
+
+  Task(Task&& other) noexcept : ops_(other.ops_) {
+    if (ops_) {
+      ops_->move(&other.storage_, &storage_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      reset();
+      ops_ = other.ops_;
+      if (ops_) {
+        ops_->move(&other.storage_, &storage_);
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  ~Task() { reset(); }
+
+  void operator()() { ops_->invoke(&storage_); }
+
+  explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+  void reset() noexcept {
+    if (ops_) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+ private:
+  typedef typename std::aligned_storage<kInlineSize, alignof(std::max_align_t)>::type Storage;
+
+  struct Ops {
+    void (*invoke)(void* storage);
+    // Moves the target to `to` and destroys what is left in `from`.
+    void (*move)(void* from, void* to);
+    void (*destroy)(void* storage);
+  };
+
+  template <class F>
+  struct Inline
+      : std::integral_constant<bool,
+                               sizeof(F) <= kInlineSize &&
+                                   alignof(std::max_align_t) % alignof(F) == 0 &&
+                                   std::is_nothrow_move_constructible<F>::value> {};
+
+  template <class F>
+  struct InlineOps {
+    static void Invoke(void* s) { (*static_cast<F*>(s))(); }
+    static void Move(void* from, void* to) noexcept {
+      new (to) F(std::move(*static_cast<F*>(from)));
+      static_cast<F*>(from)->~F();
+    }
+    static void Destroy(void* s) noexcept { static_cast<F*>(s)->~F(); }
+    static const Ops ops;
+  };
+
+  template <class F>
+  struct HeapOps {
+    static void Invoke(void* s) { (**static_cast<F**>(s))(); }
+    static void Move(void* from, void* to) noexcept {
+      *static_cast<F**>(to) = *static_cast<F**>(from);
+    }
+    static void Destroy(void* s) noexcept { delete *static_cast<F**>(s); }
+    static const Ops ops;
+  };
+
+  template <class Target, class F>
+  void Store(F&& f, std::true_type) {
+    new (&storage_) Target(std::forward<F>(f));
+    ops_ = &InlineOps<Target>::ops;
+  }
+
+  template <class Target, class F>
+  void Store(F&& f, std::false_type) {
+    *reinterpret_cast<Target**>(&storage_) = new Target(std::forward<F>(f));
+    ops_ = &HeapOps<Target>::ops;
+  }
+
+  const Ops* ops_;
+  Storage storage_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(Task);
+};
+
+template <class F>
+const Task::Ops Task::InlineOps<F>::ops = {&Task::InlineOps<F>::Invoke, &Task::InlineOps<F>::Move,
+                                           &Task::InlineOps<F>::Destroy};
+
+template <class F>
+const Task::Ops Task::HeapOps<F>::ops = {&Task::HeapOps<F>::Invoke, &Task::HeapOps<F>::Move,
+                                         &Task::HeapOps<F>::Destroy};
+
+namespace internal {
+template <class R>
+struct FutureTask {
+  template <class F>
+  static void Run(F& f, std::promise<R>& promise) {
+    promise.set_value(f());
+  }
+};
+
+template <>
+struct FutureTask<void> {
+  template <class F>
+  static void Run(F& f, std::promise<void>& promise) {
+    f();
+    promise.set_value();
+  }
+};
+
+// Task body resuming a suspended C++20 coroutine, see ThreadPool::schedule() and
+// Thread::SwitchTo(). The handle is generic so that this header builds without <coroutine>.
+//
+// An executor that drops the task (shutdown(kDiscardPending), a Thread destroyed with the task
+// still queued) destroys it without running it. The coroutine is resumed anyway, after *dropped is
+// set so that its co_await throws, instead of leaving the frame suspended and whoever waits on it
+// hanging. A task destroyed while Post() is still posting it was rejected, that exception reaches
+// the coroutine through await_suspend() and it is not resumed.
+template <class Handle>
+class ResumeCoroutine {
+ public:
+  ResumeCoroutine(ResumeCoroutine&& other) noexcept
+      : handle_(other.handle_), dropped_(other.dropped_) {
+    other.dropped_ = nullptr;
+  }
+
+  ~ResumeCoroutine() {
+    if (!dropped_)
+      return;
+    *dropped_ = true;
+    if (Posting() != dropped_)
+      handle_.resume();
+  }
+
+  void operator()() {
+    dropped_ = nullptr;
+    handle_.resume();
+  }
+
+  // Calls post(Task&&) with a task resuming `handle`. The coroutine may run as soon as it is
+  // posted, so nothing of the awaiter is touched afterwards.
+  template <class Post>
+  static void Submit(Handle handle, bool* dropped, Post post) {
+    bool*& posting = Posting();
+    posting = dropped;
+    try {
+      post(Task(ResumeCoroutine(handle, dropped)));
+    } catch (...) {
+      posting = nullptr;
+      throw;
+    }
+    posting = nullptr;
+  }
+
+ private:
+  ResumeCoroutine(Handle handle, bool* dropped) noexcept : handle_(handle), dropped_(dropped) {}
+
+  // the awaiter posting on this thread
+  static bool*& Posting() {
+    static thread_local bool* posting = nullptr;
+    return posting;
+  }
+
+  Handle handle_;
+  // null once run or moved from
+  bool* dropped_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(ResumeCoroutine);
+};
+
+template <class R, class F>
+class PromiseCall {
+ public:
+  PromiseCall(F&& f, std::promise<R>&& promise)
+      : f_(std::move(f)), promise_(std::move(promise)) {}
+  PromiseCall(PromiseCall&& other) = default;
+
+  void operator()() {
+    try {
+      FutureTask<R>::Run(f_, promise_);
+    } catch (...) {
+      promise_.set_exception(std::current_exception());
+    }
+  }
+
+ private:
+  F f_;
+  std::promise<R> promise_;
+};
+}  // namespace internal
+
+// Binds `f` to `args` into a Task and returns the future of its result.
+template <class F, class... Args>
+Task MakeFutureTask(std::future<typename std::result_of<F(Args...)>::type>* future,
+                    F&& f,
+                    Args&&... args) {
+  typedef typename std::result_of<F(Args...)>::type R;
+  typedef decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...)) Call;
+
+  std::promise<R> promise(std::allocator_arg, SizeClassAllocator<char>());
+  *future = promise.get_future();
+  return Task(internal::PromiseCall<R, Call>(
+      std::bind(std::forward<F>(f), std::forward<Args>(args)...), std::move(promise)));
+}
+}  // namespace akali
+#endif  // AKALI_TASK_H_
@@ -0,0 +1,303 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_TASK_GRAPH_H_
+#define AKALI_TASK_GRAPH_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "akali/akali_export.h"
+#include "akali/constructormagic.h"
+#include "akali/future.hpp"
+#include "akali/task.hpp"
+#include "akali/thread_pool.hpp"
+
+/*
+TaskGraph runs a dependency graph of tasks on a ThreadPool.
+
+emplace() adds a node, a.precede(b) (or b.succeed(a)) makes b wait for a. run() posts the nodes
+without predecessors and returns at once. Every node keeps an atomic count of its unfinished
+predecessors, the node that brings a count to zero schedules that successor: it runs the first one
+itself and posts the others, so there is no barrier and no central scheduler. The future returned
+by run() becomes ready when the last node finished, with the first exception a node threw; the
+nodes after a failure are skipped.
+
+A graph is reusable: run() only resets the counters, so running it again allocates nothing but the
+future's shared state (from SizeClassPool). A graph can't be changed or run again while it runs.
+A cycle is reported by run() with std::logic_error.
+
+dot() exports the graph in Graphviz format, labelled with the node timings of the last run.
+*/
+
+namespace akali {
+class TaskGraph;
+
+class TaskGraphNode {
+ public:
+  // `other` runs after this node
+  TaskGraphNode& precede(TaskGraphNode& other);
+
+  // this node runs after `other`
+  TaskGraphNode& succeed(TaskGraphNode& other) {
+    other.precede(*this);
+    return *this;
+  }
+
+  const std::string& name() const { return name_; }
+
+  // time spent in the node in the last run
+  std::chrono::nanoseconds duration() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end_ - start_);
+  }
+
+ private:
+  friend class TaskGraph;
+
+  TaskGraphNode(TaskGraph* graph, size_t index, Task&& fn, std::string name)
+      : graph_(graph)
+      , index_(index)
+      , fn_(std::move(fn))
+      , name_(std::move(name))
+      , predecessors_(0)
+      , pending_(0) {}
+
+  TaskGraph* graph_;
+  size_t index_;
+  Task fn_;
+  std::string name_;
+  std::vector<TaskGraphNode*> successors_;
+  size_t predecessors_;
+  std::atomic<size_t> pending_;
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::time_point end_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(TaskGraphNode);
+};
+
+class TaskGraph {
+ public:
+  explicit TaskGraph(std::string name = "TaskGraph")
+      : name_(std::move(name))
+      , dirty_(false)
+      , pool_(nullptr)
+      , remaining_(0)
+      , running_(false)
+      , failed_(false) {}
+
+  // adds a node calling fn(), named "node<index>" by default
+  template <class F>
+  TaskGraphNode& emplace(F&& fn, std::string name = std::string()) {
+    size_t index = nodes_.size();
+    if (name.empty())
+      name = "node" + std::to_string(index);
+    nodes_.emplace_back(new TaskGraphNode(this, index, Task(std::forward<F>(fn)), std::move(name)));
+    dirty_ = true;
+    return *nodes_.back();
+  }
+
+  size_t size() const { return nodes_.size(); }
+
+  Future<void> run(ThreadPool& pool);
+
+  std::string dot() const;
+
+ private:
+  friend class TaskGraphNode;
+
+  struct Runner {
+    void operator()() { graph->execute(node); }
+    TaskGraph* graph;
+    TaskGraphNode* node;
+  };
+
+  // finds the sources, throws on a cycle
+  void prepare();
+  void execute(TaskGraphNode* node);
+  void finish();
+
+  std::string name_;
+  std::vector<std::unique_ptr<TaskGraphNode>> nodes_;
+  // one Runner per node without predecessors, posted as a batch by run()
+  std::vector<Runner> sources_;
+  bool dirty_;
+
+  // state of the current run
+  ThreadPool* pool_;
+  std::atomic<size_t> remaining_;
+  std::atomic<bool> running_;
+  std::mutex error_mutex_;
+  std::exception_ptr error_;
+  std::atomic<bool> failed_;
+  Promise<void> promise_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(TaskGraph);
+};
+
+inline TaskGraphNode& TaskGraphNode::precede(TaskGraphNode& other) {
+  successors_.push_back(&other);
+  other.predecessors_++;
+  graph_->dirty_ = true;
+  return *this;
+}
+
+inline void TaskGraph::prepare() {
+  sources_.clear();
+  std::vector<size_t> degree(nodes_.size());
+  std::vector<TaskGraphNode*> ready;
+  for (const std::unique_ptr<TaskGraphNode>& node : nodes_) {
+    degree[node->index_] = node->predecessors_;
+    if (node->predecessors_ == 0)
+      ready.push_back(node.get());
+  }
+  for (TaskGraphNode* node : ready) {
+    Runner runner = {this, node};
+    sources_.push_back(runner);
+  }
+
+  // Kahn's algorithm, every node is reached unless it is on a cycle.
+  size_t reached = 0;
+  while (!ready.empty()) {
+    TaskGraphNode* node = ready.back();
+    ready.pop_back();
+    reached++;
+    for (TaskGraphNode* successor : node->successors_) {
+      if (--degree[successor->index_] == 0)
+        ready.push_back(successor);
+    }
+  }
+  if (reached != nodes_.size())
+    throw std::logic_error("TaskGraph has a cycle");
+  dirty_ = false;
+}
+
+inline Future<void> TaskGraph::run(ThreadPool& pool) {
+  if (running_.exchange(true))
+    throw std::logic_error("TaskGraph is already running");
+  try {
+    if (dirty_)
+      prepare();
+  } catch (...) {
+    running_ = false;
+    throw;
+  }
+
+  promise_ = Promise<void>();
+  Future<void> result = promise_.get_future();
+  if (nodes_.empty()) {
+    finish();
+    return result;
+  }
+
+  pool_ = &pool;
+  error_ = nullptr;
+  failed_ = false;
+  for (const std::unique_ptr<TaskGraphNode>& node : nodes_)
+    node->pending_.store(node->predecessors_, std::memory_order_relaxed);
+  remaining_.store(nodes_.size(), std::memory_order_release);
+
+  // The sources are admitted as one batch, so either all of them are queued or none is and the
+  // run is rolled back. Once they are queued the graph may finish and be run again, so don't
+  // touch it after that.
+  try {
+    pool.enqueue_bulk(sources_.begin(), sources_.end());
+  } catch (...) {
+    promise_ = Promise<void>();
+    running_ = false;
+    throw;
+  }
+  return result;
+}
+
+inline void TaskGraph::execute(TaskGraphNode* node) {
+  for (;;) {
+    node->start_ = std::chrono::steady_clock::now();
+    if (!failed_.load(std::memory_order_relaxed)) {
+      try {
+        node->fn_();
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (!error_)
+          error_ = std::current_exception();
+        failed_ = true;
+      }
+    }
+    node->end_ = std::chrono::steady_clock::now();
+
+    // Run one ready successor here, post the rest.
+    TaskGraphNode* next = nullptr;
+    for (TaskGraphNode* successor : node->successors_) {
+      if (successor->pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (next) {
+          Runner runner = {this, successor};
+          pool_->post(runner);
+        }
+        else {
+          next = successor;
+        }
+      }
+    }
+
+    if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      finish();
+      return;
+    }
+    if (!next)
+      return;
+    node = next;
+  }
+}
+
+inline void TaskGraph::finish() {
+  // The graph may be run again as soon as running_ is cleared.
+  Promise<void> promise = std::move(promise_);
+  std::exception_ptr error = error_;
+  running_ = false;
+  if (error)
+    promise.set_exception(error);
+  else
+    promise.set_value();
+}
+
+inline std::string TaskGraph::dot() const {
+  std::string out = "digraph \"" + name_ + "\" {\n";
+  for (const std::unique_ptr<TaskGraphNode>& node : nodes_) {
+    std::string label;
+    for (char c : node->name_) {
+      if (c == '"' || c == '\\')
+        label += '\\';
+      label += c;
+    }
+    char timing[64];
+    snprintf(timing, sizeof(timing), "\\n%.1f us", node->duration().count() / 1000.0);
+    out += "  n" + std::to_string(node->index_) + " [label=\"" + label + timing + "\"];\n";
+  }
+  for (const std::unique_ptr<TaskGraphNode>& node : nodes_) {
+    for (TaskGraphNode* successor : node->successors_) {
+      out += "  n" + std::to_string(node->index_) + " -> n" + std::to_string(successor->index_) +
+             ";\n";
+    }
+  }
+  out += "}\n";
+  return out;
+}
+}  // namespace akali
+#endif  // AKALI_TASK_GRAPH_H_
@@ -5,14 +5,18 @@
 #include "akali/akali_export.h"
 
 #if defined AKALI_WIN || defined AKALI_LINUX
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <string>
+#include <utility>
+#include <vector>
 #ifdef AKALI_WIN
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
@@ -25,13 +29,44 @@
 #endif
 
 #include "akali/constructormagic.h"
+#include "akali/location.h"
+#include "akali/log2_histogram.hpp"
+#include "akali/mpsc_queue.hpp"
+#include "akali/task.hpp"
 
 namespace akali {
+// Run times of the tasks of a Thread, kept while task tracking is on.
+struct ThreadTaskStats {
+  enum : size_t { kBuckets = kLog2HistogramBuckets };
+
+  // upper bound of the bucket holding quantile q (0 to 1), 0 before any task ran
+  std::chrono::nanoseconds Percentile(double q) const {
+    return std::chrono::nanoseconds(Log2Percentile(histogram, kBuckets, q));
+  }
+
+  uint64_t tasks;
+  std::chrono::nanoseconds busy;
+  std::chrono::nanoseconds longest;
+  // bucket i counts the tasks that ran for 2^i to 2^(i+1) nanoseconds, see log2_histogram.hpp
+  uint64_t histogram[kBuckets];
+};
+
 class Thread {
  public:
-  Thread() : thread_id_(0), exit_(false) { running_.store(false); }
-  Thread(const std::string& name) : thread_id_(0), exit_(false), thread_name_(name) {
+  Thread()
+      : thread_id_(0), exit_(false), parked_(false), next_deadline_(INT64_MAX), timer_sequence_(0) {
+    running_.store(false);
+    ResetTaskTracking();
+  }
+  Thread(const std::string& name)
+      : thread_name_(name)
+      , thread_id_(0)
+      , exit_(false)
+      , parked_(false)
+      , next_deadline_(INT64_MAX)
+      , timer_sequence_(0) {
     running_.store(false);
+    ResetTaskTracking();
   }
   virtual ~Thread() { Stop(true); }
 
@@ -64,42 +99,178 @@ class Thread {
   }
   bool IsRunning() const { return running_.load(); }
 
+  // Runs the posted tasks in batches without taking the lock, and parks only when there is
+  // nothing to do. Due timers run between batches.
   virtual void Run() {
     running_.store(true);
 
     SetCurrentThreadName(thread_name_.c_str());
     thread_id_ = Thread::GetCurThreadId();
-    while (true) {
-      std::function<void()> task;
-      {
-        std::unique_lock<std::mutex> lg(mutex_);
-        exit_cond_var_.wait(lg, [this]() { return (exit_ || !work_queue_.empty()); });
-        if (exit_) {
-          running_.store(false);
-          return;
-        }
-        task = std::move(work_queue_.front());
-        work_queue_.pop();
+    while (!exit_) {
+      if (tracking_.load(std::memory_order_relaxed))
+        heartbeat_.store(SteadyNanos(), std::memory_order_relaxed);
+      bool worked = RunDueTimers();
+      for (size_t i = 0; i < kMaxBatch && !exit_; i++) {
+        PendingTask pending;
+        if (!work_queue_.Pop(&pending))
+          break;
+        RunTask(pending.task, pending.from);
+        worked = true;
       }
-
-      task();
+      if (!worked)
+        Park();
     }
+    running_.store(false);
   }
 
   template <class F, class... Args>
   auto Invoke(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type> {
+    return InvokeFrom(Location(), std::forward<F>(f), std::forward<Args>(args)...);
+  }
+
+  // Like Invoke, the watchdog names `from` (usually AKALI_FROM_HERE) when the task hangs.
+  template <class F, class... Args>
+  auto InvokeFrom(const Location& from, F&& f, Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type> {
     using return_type = typename std::result_of<F(Args...)>::type;
-    auto task = std::make_shared<std::packaged_task<return_type()>>(
-        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
 
-    std::future<return_type> res = task->get_future();
+    std::future<return_type> res;
+    PostTask(MakeFutureTask(&res, std::forward<F>(f), std::forward<Args>(args)...), from);
+    return res;
+  }
+
+  // Like Invoke, without a future. The task must not throw.
+  template <class F>
+  void Post(F&& f) {
+    PostTask(Task(std::forward<F>(f)));
+  }
+
+  template <class F>
+  void PostFrom(const Location& from, F&& f) {
+    PostTask(Task(std::forward<F>(f)), from);
+  }
+
+  template <class F, class Arg, class... Args>
+  void Post(F&& f, Arg&& arg, Args&&... args) {
+    PostTask(
+        Task(std::bind(std::forward<F>(f), std::forward<Arg>(arg), std::forward<Args>(args)...)));
+  }
+
+  // co_await thread.SwitchTo() resumes a C++20 coroutine on this thread, see coroutine.hpp. If
+  // the Thread is destroyed with the task still queued, co_await throws
+  // std::future_error(broken_promise) on the destroying thread.
+  struct SwitchAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <class Handle>
+    void await_suspend(Handle handle) {
+      Thread* target = thread;
+      internal::ResumeCoroutine<Handle>::Submit(
+          handle, &dropped, [target](Task&& task) { target->PostTask(std::move(task)); });
+    }
+    void await_resume() const {
+      if (dropped)
+        throw std::future_error(std::future_errc::broken_promise);
+    }
+
+    Thread* thread;
+    bool dropped;
+  };
+  SwitchAwaiter SwitchTo() {
+    SwitchAwaiter awaiter = {this, false};
+    return awaiter;
+  }
 
+  // Lock free, the thread is only signalled when it is parked.
+  void PostTask(Task&& task, const Location& from = Location()) {
+    work_queue_.Push(PendingTask(std::move(task), from));
+    // Pairs with the fence in Park(): either the thread sees the task, or we see it parked.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_.load(std::memory_order_relaxed)) {
+      // Under the lock: once the task ran, the Thread may be destroyed by whoever waited for it.
+      std::lock_guard<std::mutex> lock(mutex_);
+      exit_cond_var_.notify_one();
+    }
+  }
+
+  // Task tracking publishes the start and origin of the running task for Watchdog, a heartbeat,
+  // and keeps the run time histogram of GetTaskStats(). It costs two clock reads per task.
+  void EnableTaskTracking(bool enable) { tracking_.store(enable, std::memory_order_relaxed); }
+
+  ThreadTaskStats GetTaskStats() const {
+    ThreadTaskStats stats;
+    stats.tasks = task_count_.load(std::memory_order_relaxed);
+    stats.busy = std::chrono::nanoseconds(busy_ns_.load(std::memory_order_relaxed));
+    stats.longest = std::chrono::nanoseconds(longest_ns_.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < ThreadTaskStats::kBuckets; i++)
+      stats.histogram[i] = histogram_[i].load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  // Start and origin of the task running now, false between tasks or without task tracking.
+  bool GetRunningTask(std::chrono::steady_clock::time_point* start, Location* from) const {
+    int64_t started = task_start_.load(std::memory_order_acquire);
+    if (started == 0)
+      return false;
+    Location where(running_function_.load(std::memory_order_relaxed),
+                   running_file_.load(std::memory_order_relaxed),
+                   running_line_.load(std::memory_order_relaxed));
+    // The location is only valid if the same task still runs, see RunTask().
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (task_start_.load(std::memory_order_relaxed) != started)
+      return false;
+    *start = std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::nanoseconds(started)));
+    *from = where;
+    return true;
+  }
+
+  // Last time the thread went through its loop or finished a task, with task tracking.
+  std::chrono::steady_clock::time_point LastHeartbeat() const {
+    return std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::nanoseconds(heartbeat_.load(std::memory_order_relaxed))));
+  }
+
+  typedef uint64_t DelayedTaskId;
+
+  // Runs f on this thread once `delay` has passed, without blocking the thread meanwhile. The
+  // task must not throw.
+  template <class Rep, class Period, class F>
+  DelayedTaskId PostDelayedTask(const std::chrono::duration<Rep, Period>& delay, F&& f) {
+    return AddTimer(std::chrono::steady_clock::now() +
+                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay),
+                    std::chrono::steady_clock::duration::zero(), Task(std::forward<F>(f)));
+  }
+
+  // Runs f every `interval`, the first time one interval from now. A late run doesn't make up
+  // for the runs it missed. The task must not throw.
+  template <class Rep, class Period, class F>
+  DelayedTaskId PostRepeatingTask(const std::chrono::duration<Rep, Period>& interval, F&& f) {
+    std::chrono::steady_clock::duration period = std::max(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval),
+        std::chrono::steady_clock::duration(1));
+    return AddTimer(std::chrono::steady_clock::now() + period, period, Task(std::forward<F>(f)));
+  }
+
+  // Cancels a delayed or repeating task in O(log n), false if it already ran or was cancelled.
+  // A repeating task that is running right now finishes that run.
+  bool CancelDelayedTask(DelayedTaskId id) {
+    size_t slot = static_cast<size_t>(id & 0xffffffffu);
+    uint32_t generation = static_cast<uint32_t>(id >> 32);
+    Task dropped;
     {
       std::unique_lock<std::mutex> lock(mutex_);
-      work_queue_.emplace([task]() { (*task)(); });
+      if (slot >= timers_.size() || !timers_[slot].in_use ||
+          timers_[slot].generation != generation)
+        return false;
+      Timer& timer = timers_[slot];
+      if (timer.heap_index != kNotInHeap)
+        RemoveTimerAt(timer.heap_index);
+      dropped = std::move(timer.task);
+      FreeTimerLocked(slot);
     }
-    exit_cond_var_.notify_one();
-    return res;
+    return true;
   }
 
   static void SetCurrentThreadName(const char* name) {
@@ -130,14 +301,288 @@ class Thread {
   }
 
  protected:
+  struct PendingTask {
+    PendingTask() {}
+    PendingTask(Task&& t, const Location& l) : task(std::move(t)), from(l) {}
+
+    Task task;
+    Location from;
+  };
+
+  // kMaxBatch tasks at most run between two looks at the timers and exit_
+  enum : size_t { kNotInHeap = static_cast<size_t>(-1), kMaxBatch = 256 };
+
+  // A delayed or repeating task. timer_heap_ is a min-heap of slots in timers_ and every slot
+  // knows its heap position, so a cancelled task is taken out of the middle in O(log n). The
+  // generation in a DelayedTaskId tells a reused slot from the task it was issued for.
+  struct Timer {
+    std::chrono::steady_clock::time_point deadline;
+    // zero for a one-shot task
+    std::chrono::steady_clock::duration interval;
+    // keeps tasks with the same deadline in FIFO order
+    uint64_t sequence;
+    Task task;
+    // kNotInHeap while the slot is free or its task runs
+    size_t heap_index;
+    uint32_t generation;
+    bool in_use;
+  };
+
+  DelayedTaskId AddTimer(std::chrono::steady_clock::time_point deadline,
+                         std::chrono::steady_clock::duration interval,
+                         Task&& task) {
+    DelayedTaskId id = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      size_t slot = timers_.size();
+      if (free_timers_.empty()) {
+        timers_.emplace_back();
+        timers_.back().generation = 1;
+      }
+      else {
+        slot = free_timers_.back();
+        free_timers_.pop_back();
+      }
+      Timer& timer = timers_[slot];
+      timer.deadline = deadline;
+      timer.interval = interval;
+      timer.sequence = timer_sequence_++;
+      timer.task = std::move(task);
+      timer.in_use = true;
+      PushTimerLocked(slot);
+      id = (static_cast<DelayedTaskId>(timer.generation) << 32) | slot;
+    }
+    exit_cond_var_.notify_one();
+    return id;
+  }
+
+  // Runs the timers that are due, true if there were any.
+  bool RunDueTimers() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now.time_since_epoch().count() < next_deadline_.load(std::memory_order_relaxed))
+      return false;
+    bool ran = false;
+    for (;;) {
+      Task task;
+      size_t timer = kNotInHeap;
+      uint32_t generation = 0;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Timers re-armed by this loop are due after `now`, so it ends.
+        if (exit_ || timer_heap_.empty() || timers_[timer_heap_[0]].deadline > now)
+          return ran;
+        timer = timer_heap_[0];
+        generation = timers_[timer].generation;
+        task = TakeTimerLocked(timer);
+        // a one-shot task is done with its slot
+        if (!timers_[timer].in_use)
+          timer = kNotInHeap;
+      }
+      RunTask(task, Location());
+      ran = true;
+      if (timer != kNotInHeap)
+        RescheduleTimer(timer, generation, std::move(task));
+    }
+  }
+
+  static int64_t SteadyNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Single writer, a plain load and store is enough.
+  static void Count(std::atomic<uint64_t>& counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  void ResetTaskTracking() {
+    tracking_.store(false, std::memory_order_relaxed);
+    task_start_.store(0, std::memory_order_relaxed);
+    running_function_.store("", std::memory_order_relaxed);
+    running_file_.store("", std::memory_order_relaxed);
+    running_line_.store(0, std::memory_order_relaxed);
+    heartbeat_.store(0, std::memory_order_relaxed);
+    task_count_.store(0, std::memory_order_relaxed);
+    busy_ns_.store(0, std::memory_order_relaxed);
+    longest_ns_.store(0, std::memory_order_relaxed);
+    for (std::atomic<uint64_t>& count : histogram_)
+      count.store(0, std::memory_order_relaxed);
+  }
+
+  void RunTask(Task& task, const Location& from) {
+    if (!tracking_.load(std::memory_order_relaxed)) {
+      task();
+      return;
+    }
+    // A seqlock around the running task: the location is written after the release fence and
+    // published by task_start_, GetRunningTask() rejects it if task_start_ changed meanwhile.
+    std::atomic_thread_fence(std::memory_order_release);
+    running_function_.store(from.function_name(), std::memory_order_relaxed);
+    running_file_.store(from.file_name(), std::memory_order_relaxed);
+    running_line_.store(from.line_number(), std::memory_order_relaxed);
+    int64_t start = std::max<int64_t>(SteadyNanos(), 1);
+    task_start_.store(start, std::memory_order_release);
+
+    task();
+
+    int64_t end = SteadyNanos();
+    task_start_.store(0, std::memory_order_release);
+    heartbeat_.store(end, std::memory_order_relaxed);
+    uint64_t ran = end > start ? static_cast<uint64_t>(end - start) : 0;
+    Count(task_count_, 1);
+    Count(busy_ns_, ran);
+    Count(histogram_[Log2Bucket(ran)], 1);
+    if (ran > longest_ns_.load(std::memory_order_relaxed))
+      longest_ns_.store(ran, std::memory_order_relaxed);
+  }
+
+  // Waits for a task, a timer or Stop().
+  void Park() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    parked_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!exit_ && work_queue_.Empty()) {
+      if (timer_heap_.empty()) {
+        exit_cond_var_.wait(lock);
+      }
+      else {
+        // a copy, timers_ may grow while we wait
+        std::chrono::steady_clock::time_point deadline = timers_[timer_heap_[0]].deadline;
+        exit_cond_var_.wait_until(lock, deadline);
+      }
+    }
+    parked_.store(false, std::memory_order_relaxed);
+  }
+
+  // must hold mutex_, takes the task of the due timer at the top of the heap
+  Task TakeTimerLocked(size_t slot) {
+    RemoveTimerAt(0);
+    Task task = std::move(timers_[slot].task);
+    if (timers_[slot].interval == std::chrono::steady_clock::duration::zero())
+      FreeTimerLocked(slot);
+    return task;
+  }
+
+  // Puts a repeating task back after its run, unless it was cancelled meanwhile.
+  void RescheduleTimer(size_t slot, uint32_t generation, Task&& task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Timer& timer = timers_[slot];
+    if (!timer.in_use || timer.generation != generation)
+      return;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    timer.deadline += timer.interval;
+    if (timer.deadline <= now)
+      timer.deadline = now + timer.interval;
+    timer.sequence = timer_sequence_++;
+    timer.task = std::move(task);
+    PushTimerLocked(slot);
+  }
+
+  void FreeTimerLocked(size_t slot) {
+    Timer& timer = timers_[slot];
+    timer.in_use = false;
+    if (++timer.generation == 0)
+      timer.generation = 1;
+    free_timers_.push_back(slot);
+  }
+
+  bool TimerBefore(size_t a, size_t b) const {
+    const Timer& x = timers_[a];
+    const Timer& y = timers_[b];
+    return x.deadline < y.deadline || (x.deadline == y.deadline && x.sequence < y.sequence);
+  }
+
+  void SwapTimers(size_t a, size_t b) {
+    std::swap(timer_heap_[a], timer_heap_[b]);
+    timers_[timer_heap_[a]].heap_index = a;
+    timers_[timer_heap_[b]].heap_index = b;
+  }
+
+  void SiftTimerUp(size_t pos) {
+    while (pos > 0) {
+      size_t parent = (pos - 1) / 2;
+      if (!TimerBefore(timer_heap_[pos], timer_heap_[parent]))
+        break;
+      SwapTimers(pos, parent);
+      pos = parent;
+    }
+  }
+
+  void SiftTimerDown(size_t pos) {
+    for (;;) {
+      size_t first = pos;
+      size_t left = 2 * pos + 1;
+      size_t right = left + 1;
+      if (left < timer_heap_.size() && TimerBefore(timer_heap_[left], timer_heap_[first]))
+        first = left;
+      if (right < timer_heap_.size() && TimerBefore(timer_heap_[right], timer_heap_[first]))
+        first = right;
+      if (first == pos)
+        break;
+      SwapTimers(pos, first);
+      pos = first;
+    }
+  }
+
+  void PushTimerLocked(size_t slot) {
+    timer_heap_.push_back(slot);
+    timers_[slot].heap_index = timer_heap_.size() - 1;
+    SiftTimerUp(timer_heap_.size() - 1);
+    UpdateNextDeadlineLocked();
+  }
+
+  void RemoveTimerAt(size_t pos) {
+    size_t last = timer_heap_.size() - 1;
+    timers_[timer_heap_[pos]].heap_index = kNotInHeap;
+    if (pos != last) {
+      timer_heap_[pos] = timer_heap_[last];
+      timers_[timer_heap_[pos]].heap_index = pos;
+    }
+    timer_heap_.pop_back();
+    if (pos < timer_heap_.size()) {
+      SiftTimerDown(pos);
+      SiftTimerUp(pos);
+    }
+    UpdateNextDeadlineLocked();
+  }
+
+  void UpdateNextDeadlineLocked() {
+    next_deadline_.store(timer_heap_.empty()
+                             ? INT64_MAX
+                             : timers_[timer_heap_[0]].deadline.time_since_epoch().count(),
+                         std::memory_order_relaxed);
+  }
+
   std::string thread_name_;
   std::future<void> thread_;
   long thread_id_;
   std::mutex mutex_;
   std::condition_variable exit_cond_var_;
-  bool exit_;
-  std::queue<std::function<void()>> work_queue_;
+  std::atomic_bool exit_;
+  MpscQueue<PendingTask> work_queue_;
   std::atomic_bool running_;
+  // the thread waits in Park(), set under mutex_
+  std::atomic_bool parked_;
+  // deadline of the first timer, as steady_clock ticks, so that Run() can skip the lock
+  std::atomic<int64_t> next_deadline_;
+  // guarded by mutex_
+  std::vector<Timer> timers_;
+  std::vector<size_t> free_timers_;
+  std::vector<size_t> timer_heap_;
+  uint64_t timer_sequence_;
+  // task tracking, written by the thread only
+  std::atomic_bool tracking_;
+  // steady_clock nanoseconds, 0 between tasks
+  std::atomic<int64_t> task_start_;
+  std::atomic<const char*> running_function_;
+  std::atomic<const char*> running_file_;
+  std::atomic<int> running_line_;
+  std::atomic<int64_t> heartbeat_;
+  std::atomic<uint64_t> task_count_;
+  std::atomic<uint64_t> busy_ns_;
+  std::atomic<uint64_t> longest_ns_;
+  std::atomic<uint64_t> histogram_[ThreadTaskStats::kBuckets];
   AKALI_DISALLOW_COPY_AND_ASSIGN(Thread);
 };
 }  // namespace akali
@@ -4,56 +4,570 @@
 // borrow from https://github.com/progschj/ThreadPool
 // origin name is ThreadPool.h
 //
+// Every worker owns a work-stealing deque (see work_stealing_deque.hpp), tasks enqueued from
+// outside the pool go through a shared injection queue. In kSharedQueue mode (default) workers
+// also enqueue into the injection queue, which is the original single queue design. In
+// kWorkStealing mode a task enqueued by a worker goes to the bottom of that worker's deque, is
+// popped back by it in LIFO order, and idle workers steal from the top of random victims, so
+// workers only meet on the injection queue lock when the pool is fed from outside.
+//
+// Tasks are akali::Task (see task.hpp) kept in nodes from a ConcurrentMemoryPool, and the
+// injection queue is a list linked through the nodes. post() of a small callable allocates
+// nothing once the pool is warm, enqueue() only adds the future's shared state, which comes
+// from SizeClassPool. A task given to post() must not throw.
+//
+// enqueue_bulk() hands a whole batch over with one lock round-trip and wakes at most one worker
+// per task. parallel_for()/parallel_reduce() split an index range among the workers and the
+// calling thread: every participant claims the next chunk from a shared counter, chunks start at
+// a share of the range and shrink as it runs out (guided scheduling) but never below `grain`, so
+// uneven items balance out without a chunk per item.
+//
+// The injection queue is split into priority lanes. enqueue_with_priority() picks the lane, the
+// other entry points use TaskPriority::kNormal. A worker serves the highest non-empty lane, and
+// a kHigh task is taken even before the worker's own deque. Within a lane, tasks given a deadline
+// (enqueue_with_deadline()) run earliest deadline first, ahead of the lane's FIFO tasks. To keep
+// low lanes moving, a lane that was passed over kAgingLimit times while it had tasks is served
+// next. lane_stats() reports the queue depth and these events per lane. Tasks a worker keeps in
+// its own deque count as kNormal and are not part of the lane counters.
+//
+// A pool built with ThreadPool(min_threads, max_threads) is elastic. It starts min_threads
+// workers and adds one, up to max_threads, when no worker is idle and the oldest task of the
+// injection queue has waited grow_latency or longer, or at once when no worker is left. This is
+// checked when a task is enqueued or taken, and by a supervisor thread at the time the oldest task
+// becomes due, so that a pool whose workers are all stuck grows without further submissions. A
+// worker that stayed parked for idle_timeout retires unless only min_threads are left.
+// Every worker, elastic or not, spins for a few microseconds with backoff before it parks, so a
+// burst of tasks doesn't pay a futex wake per task.
+//
+// ThreadPoolOptions collects all the settings. Workers can be named (name_prefix followed by the
+// worker index) and pinned, to an explicit CPU set or one worker per physical core (see
+// cpu_topology.h). With numa_groups, pinned workers are grouped by the NUMA node of their CPU:
+// each group parks on its own condition variable and has its own queue, which
+// enqueue_on_node()/post_on_node() target so that a task runs next to its memory. A worker serves
+// its group's queue first and steals from its own group first; the other groups' queues are only
+// served when there is nothing else to do, so a busy node doesn't strand its tasks.
+//
+// With collect_stats, stats() reports the queue depth, the enqueue-to-start latency and run time
+// of the tasks as log2-bucketed histograms, how busy the workers are and how often they steal and
+// park. Each worker counts into its own block without locks or shared cache lines, stats() merges
+// the blocks, so a snapshot is only approximately consistent while tasks run. Without
+// collect_stats a worker doesn't read the clock around its tasks.
+//
+// queue_capacity bounds the injection queue for callers outside the pool: once it holds that many
+// tasks, enqueue() and friends block until a worker takes one (ThreadPoolOverflow::kBlock) or throw
+// (kReject), try_enqueue()/try_post() report the full queue instead. Workers are never held up, a
+// worker blocking on its own pool could deadlock it. shutdown(kDrain), which the destructor calls,
+// runs every queued task before joining; shutdown(kDiscardPending) drops the tasks that haven't
+// started, so their futures fail with broken_promise, and cancels token() for the running ones to
+// notice (see cancellation_token.hpp).
+//
+// async() is enqueue() returning an akali::Future (see future.hpp), whose then()/then_on()
+// continuations are scheduled when the task completes instead of blocking a worker in get().
+// schedule() is the C++20 coroutine hook, `co_await pool.schedule()` continues on a worker (see
+// coroutine.hpp).
+//
 
 #include <vector>
-#include <queue>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <iterator>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include "akali/arch.h"
+#include "akali/cancellation_token.hpp"
+#include "akali/concurrent_memory_pool.hpp"
+#include "akali/cpu_topology.h"
+#include "akali/future.hpp"
+#include "akali/log2_histogram.hpp"
+#include "akali/task.hpp"
+#include "akali/thread.hpp"
+#include "akali/work_stealing_deque.hpp"
+
+#if defined(AKALI_ARCH_X86_FAMILY)
+#define AKALI_THREAD_POOL_HAS_PAUSE
+#include <immintrin.h>
+#endif
 
 namespace akali {
+enum class ThreadPoolMode { kSharedQueue, kWorkStealing };
+
+enum class TaskPriority { kHigh = 0, kNormal = 1, kLow = 2 };
+
+struct ThreadPoolLaneStats {
+  size_t depth;              // tasks waiting in the lane now
+  size_t max_depth;          // deepest the lane has been
+  uint64_t enqueued;
+  uint64_t dequeued;
+  uint64_t aged;             // times the lane was served ahead of a higher one by aging
+  uint64_t deadline_misses;  // tasks that started after their deadline
+};
+
+struct ThreadPoolStats {
+  enum : size_t { kBuckets = kLog2HistogramBuckets };
+
+  // busy / (busy + idle), 0 before any task ran
+  double busy_ratio() const;
+  // upper bound of the bucket holding quantile q (0 to 1) of a histogram, 0 when it's empty
+  static std::chrono::nanoseconds percentile(const uint64_t (&histogram)[kBuckets], double q);
+
+  size_t workers;           // running workers
+  size_t queue_depth;       // tasks waiting now, in the injection queue or a worker's deque
+  size_t peak_queue_depth;  // deepest the injection queue has been
+  uint64_t tasks;           // tasks run
+  uint64_t steals;          // tasks taken from another worker's deque
+  uint64_t parks;           // times a worker went to sleep
+  std::chrono::nanoseconds busy;  // time the workers spent running tasks
+  std::chrono::nanoseconds idle;  // time they spent looking for work, spinning or parked
+  // Bucket i counts the tasks that waited from enqueue to start, or ran, for 2^i to 2^(i+1)
+  // nanoseconds. The first bucket includes 0, the last one everything longer.
+  uint64_t wait_histogram[kBuckets];
+  uint64_t run_histogram[kBuckets];
+};
+
+inline double ThreadPoolStats::busy_ratio() const {
+  std::chrono::nanoseconds total = busy + idle;
+  return total.count() > 0 ? static_cast<double>(busy.count()) / total.count() : 0.0;
+}
+
+inline std::chrono::nanoseconds ThreadPoolStats::percentile(
+    const uint64_t (&histogram)[kBuckets],
+    double q) {
+  return std::chrono::nanoseconds(Log2Percentile(histogram, kBuckets, q));
+}
+
+enum class ThreadPoolAffinity { kNone, kCpuSet, kPhysicalCores };
+
+// what a full bounded queue does to the caller
+enum class ThreadPoolOverflow { kBlock, kReject };
+
+enum class ThreadPoolShutdown { kDrain, kDiscardPending };
+
+struct ThreadPoolOptions {
+  ThreadPoolOptions()
+      : min_threads(0)
+      , max_threads(0)
+      , mode(ThreadPoolMode::kSharedQueue)
+      , affinity(ThreadPoolAffinity::kNone)
+      , numa_groups(false)
+      , collect_stats(false)
+      , queue_capacity(0)
+      , overflow(ThreadPoolOverflow::kBlock)
+      , grow_latency(std::chrono::milliseconds(1))
+      , idle_timeout(std::chrono::seconds(10)) {}
+
+  // max_threads below min_threads means a fixed pool of min_threads. With kPhysicalCores and
+  // both 0, the pool runs one worker per physical core.
+  size_t min_threads;
+  size_t max_threads;
+  ThreadPoolMode mode;
+  // workers are named name_prefix + index, unnamed when empty
+  std::string name_prefix;
+  // kCpuSet pins worker i to cpus[i % cpus.size()], kPhysicalCores to the i-th physical core
+  ThreadPoolAffinity affinity;
+  std::vector<int> cpus;
+  // group pinned workers by NUMA node, see enqueue_on_node()
+  bool numa_groups;
+  // keep the counters behind stats()
+  bool collect_stats;
+  // tasks the injection queue takes from outside the pool, 0 for no limit
+  size_t queue_capacity;
+  ThreadPoolOverflow overflow;
+  std::chrono::microseconds grow_latency;
+  std::chrono::milliseconds idle_timeout;
+};
+
 class ThreadPool {
  public:
-  ThreadPool(size_t);
+  ThreadPool(size_t, ThreadPoolMode mode = ThreadPoolMode::kSharedQueue);
+  // elastic pool, runs between min_threads and max_threads workers
+  ThreadPool(size_t min_threads,
+             size_t max_threads,
+             ThreadPoolMode mode = ThreadPoolMode::kSharedQueue);
+  explicit ThreadPool(const ThreadPoolOptions& options);
   template <class F, class... Args>
   auto enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
+  // like enqueue(), the result can be continued with then()/then_on()
+  template <class F, class... Args>
+  auto async(F&& f, Args&&... args) -> Future<typename std::result_of<F(Args...)>::type>;
+  // fire and forget, no future is created
+  template <class F>
+  void post(F&& f);
+  template <class F, class Arg, class... Args>
+  void post(F&& f, Arg&& arg, Args&&... args);
+  // like enqueue()/post(), but give up when the bounded queue is full: the future isn't valid(),
+  // try_post() returns false
+  template <class F, class... Args>
+  auto try_enqueue(F&& f, Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type>;
+  template <class F>
+  bool try_post(F&& f);
+
+  template <class F, class... Args>
+  auto enqueue_with_priority(TaskPriority priority, F&& f, Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type>;
+  template <class F, class... Args>
+  auto enqueue_with_deadline(TaskPriority priority,
+                             std::chrono::steady_clock::time_point deadline,
+                             F&& f,
+                             Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type>;
+
+  // queue the task for the workers of NUMA node `node`, or as a normal task when the pool has no
+  // group for that node
+  template <class F, class... Args>
+  auto enqueue_on_node(int node, F&& f, Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type>;
+  template <class F>
+  void post_on_node(int node, F&& f);
+
+  ThreadPoolLaneStats lane_stats(TaskPriority priority);
+  // merged counters of all workers, zero but for the queue depth without collect_stats
+  ThreadPoolStats stats();
+
+  enum : size_t { kLaneCount = 3, kAgingLimit = 8 };
+
+  // posts every callable of [first, last), a batch costs one lock round-trip. The range is
+  // measured before it is read, so it has to be a forward range.
+  template <class ForwardIt>
+  void enqueue_bulk(ForwardIt first, ForwardIt last);
+
+  // calls fn(i) for every i in [begin, end) and returns once all calls are done, the calling
+  // thread takes part. The first exception thrown by fn is rethrown, remaining items are skipped.
+  template <class Index, class Fn>
+  void parallel_for(Index begin, Index end, Index grain, Fn fn);
+  // like parallel_for(), but calls fn(chunk_begin, chunk_end) once per chunk
+  template <class Index, class Fn>
+  void parallel_for_chunks(Index begin, Index end, Index grain, Fn fn);
+
+  // folds every chunk with fn(chunk_begin, chunk_end, identity) -> T and merges the chunk results
+  // with combine(T, T) -> T in no particular order, so combine must be associative and
+  // commutative.
+  template <class Index, class T, class Fn, class Combine>
+  T parallel_reduce(Index begin, Index end, Index grain, T identity, Fn fn, Combine combine);
+
+  // queue wait that makes an elastic pool add a worker, 1ms by default
+  void set_grow_latency(std::chrono::microseconds latency);
+  // how long a worker of an elastic pool stays parked before it retires, 10s by default
+  void set_idle_timeout(std::chrono::milliseconds timeout);
+
+  enum : size_t { kSpinRounds = 16, kPauseRounds = 10 };
+
+  // co_await pool.schedule() resumes a C++20 coroutine on a worker, see coroutine.hpp. The awaiter
+  // takes any coroutine handle, so this header builds without <coroutine>. If shutdown() drops
+  // the task, co_await throws std::future_error(broken_promise) on the thread that dropped it.
+  struct ScheduleAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <class Handle>
+    void await_suspend(Handle handle) {
+      ThreadPool* target = pool;
+      internal::ResumeCoroutine<Handle>::Submit(
+          handle, &dropped, [target](Task&& task) { target->post(std::move(task)); });
+    }
+    void await_resume() const {
+      if (dropped)
+        throw std::future_error(std::future_errc::broken_promise);
+    }
+
+    ThreadPool* pool;
+    bool dropped;
+  };
+  ScheduleAwaiter schedule() {
+    ScheduleAwaiter awaiter = {this, false};
+    return awaiter;
+  }
+
+  // number of running workers
+  size_t size() const { return live.load(std::memory_order_relaxed); }
+
+  // Stops taking tasks from outside the pool and joins the workers, see above. Must not be called
+  // from a worker.
+  void shutdown(ThreadPoolShutdown how = ThreadPoolShutdown::kDrain);
+  // cancelled by shutdown(kDiscardPending)
+  CancellationToken token() const { return cancellation.token(); }
+
   ~ThreadPool();
 
  private:
-  // need to keep track of threads so we can join them
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  struct TaskNode {
+    explicit TaskNode(Task&& t) : task(std::move(t)), next(nullptr), deadline(TimePoint::max()) {}
+    Task task;
+    TaskNode* next;
+    TimePoint deadline;
+    // only set in elastic pools and with collect_stats
+    TimePoint enqueued;
+  };
+
+  struct Lane {
+    TaskNode* head;
+    TaskNode* tail;
+    // min-heap on deadline
+    std::vector<TaskNode*> deadlines;
+    size_t skipped;
+    ThreadPoolLaneStats stats;
+  };
+
+  // Written by the owning worker only, read by stats() while it runs.
+  struct WorkerStats {
+    std::atomic<uint64_t> tasks;
+    std::atomic<uint64_t> steals;
+    std::atomic<uint64_t> parks;
+    std::atomic<uint64_t> busy_ns;
+    std::atomic<uint64_t> idle_ns;
+    std::atomic<uint64_t> wait[ThreadPoolStats::kBuckets];
+    std::atomic<uint64_t> run[ThreadPoolStats::kBuckets];
+  };
+
+  struct Worker {
+    WorkStealingDeque<TaskNode*> local;
+    uint32_t rng;
+    // Counts find_task() calls, every 61st looks at the injection queue first.
+    uint32_t ticks;
+    // A thread runs in this slot, guarded by queue_mutex.
+    bool running;
+    // CPU the worker is pinned to, -1 if it isn't
+    int cpu;
+    size_t group;
+    // null without collect_stats
+    std::unique_ptr<WorkerStats> stats;
+  };
+
+  // Workers of one NUMA node, a single group for the whole pool without numa_groups.
+  struct Group {
+    int node;
+    // parks the group's idle workers, parked counts them
+    std::condition_variable condition;
+    std::atomic<size_t> parked;
+    // tasks enqueued for the node, guarded by queue_mutex
+    TaskNode* head;
+    TaskNode* tail;
+  };
+
+  static ThreadPoolOptions make_options(size_t min_threads,
+                                        size_t max_threads,
+                                        ThreadPoolMode mode);
+  // With try_only, false when the bounded queue is full.
+  bool submit(Task&& task, bool try_only = false);
+  void submit_to_lane(Task&& task, size_t lane, TimePoint deadline);
+  void submit_to_node(Task&& task, int node);
+  // must hold queue_mutex. Makes room for n tasks in the bounded queue, waiting if the policy says
+  // so. False when there is none, the caller then frees its nodes and calls reject().
+  bool admit_locked(std::unique_lock<std::mutex>& lock, size_t n, bool try_only);
+  void reject() const;
+  // must hold queue_mutex, unlinks every queued task
+  TaskNode* unlink_all_locked();
+  // deletes a list of nodes without running them
+  void drop(TaskNode* head);
+  // must hold queue_mutex
+  void push_locked(size_t lane, TaskNode* head, TaskNode* tail, size_t n);
+  TaskNode* pop_locked();
+  // pops from the queue of `group`, or of any group when group is -1
+  TaskNode* pop_group_locked(size_t group);
+  // submits make(0) ... make(n - 1), with try_only false when the bounded queue is full
+  template <class Make>
+  bool submit_bulk(size_t n, Make make, bool try_only = false);
+  template <class Index, class Body>
+  void parallel_chunks(Index begin, Index end, Index grain, Body& body);
+  TaskNode* find_task(size_t self);
+  bool has_work() const;
+  bool steal(size_t self, bool own_group, TaskNode** task);
+  // Spins with backoff while there's no work, true when work showed up.
+  bool spin() const;
+  bool elastic() const { return min_threads < max_threads; }
+  // Stamps the enqueue time of the nodes about to be queued, if the pool needs it.
+  void stamp(TaskNode* head) const;
+  // single writer, so a plain load and store is enough
+  static void count(std::atomic<uint64_t>& counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  static uint64_t to_ns(TimePoint::duration d);
+  // must hold queue_mutex, starts a worker if the injection queue is too slow, or arms the
+  // supervisor for when it will be
+  void grow_locked();
+  // elastic pools only, calls grow_locked() at grow_at until the pool stops
+  void supervise();
+  void start_worker_locked(size_t slot);
+  void wake_one();
+  void wake(size_t n);
+  // wakes a parked worker, one of `group` if it has any
+  void notify(size_t group);
+  void run(size_t self);
+
+  // Index of the calling worker thread in `this` pool, -1 when called from outside.
+  size_t current_worker() const;
+  static const ThreadPool*& tls_pool();
+  static size_t& tls_index();
+
+  ThreadPoolMode mode;
+  size_t min_threads;
+  size_t max_threads;
+  std::string name_prefix;
+  bool collect_stats;
+  size_t capacity;
+  ThreadPoolOverflow overflow;
+  // guarded by queue_mutex
+  std::chrono::microseconds grow_latency;
+  std::chrono::milliseconds idle_timeout;
+
+  // need to keep track of threads so we can join them. There is a slot for each of the
+  // max_threads workers, a retired worker's thread is joined when its slot is reused.
   std::vector<std::thread> workers;
-  // the task queue
-  std::queue<std::function<void()>> tasks;
+  std::vector<std::unique_ptr<Worker>> queues;
+  std::atomic<size_t> live;
+  std::thread supervisor;
+  // guarded by queue_mutex, when the oldest queued task is due for growing, max when none is
+  TimePoint grow_at;
+  std::condition_variable grow_wakeup;
+
+  ConcurrentMemoryPool<TaskNode> nodes;
 
-  // synchronization
+  // the injection queue, pending mirrors its size so that it can be checked without the lock,
+  // high_pending the size of the kHigh lane
+  Lane lanes[kLaneCount];
+  std::atomic<size_t> pending;
+  std::atomic<size_t> high_pending;
+  // guarded by queue_mutex
+  size_t peak_pending;
+
+  // synchronization, idle workers park on their group's condition under `queue_mutex`
   std::mutex queue_mutex;
-  std::condition_variable condition;
-  bool stop;
+  std::vector<std::unique_ptr<Group>> groups;
+  std::atomic<size_t> wake_cursor;
+  std::atomic<size_t> sleepers;
+  std::atomic<bool> stop;
+  // producers waiting for room in the bounded queue wait on `space`, blocked counts them
+  std::condition_variable space;
+  size_t blocked;
+  // set by shutdown(kDiscardPending), workers drop the tasks they still find
+  std::atomic<bool> discard;
+  CancellationSource cancellation;
 };
 
 // the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads) : stop(false) {
-  for (size_t i = 0; i < threads; ++i)
-    workers.emplace_back([this] {
-      for (;;) {
-        std::function<void()> task;
-
-        {
-          std::unique_lock<std::mutex> lock(this->queue_mutex);
-          this->condition.wait(lock, [this] { return this->stop || !this->tasks.empty(); });
-          if (this->stop && this->tasks.empty())
-            return;
-          task = std::move(this->tasks.front());
-          this->tasks.pop();
-        }
-
-        task();
+inline ThreadPool::ThreadPool(size_t threads, ThreadPoolMode mode)
+    : ThreadPool(make_options(threads, threads, mode)) {}
+
+inline ThreadPool::ThreadPool(size_t min_threads, size_t max_threads, ThreadPoolMode mode)
+    : ThreadPool(make_options(min_threads, max_threads, mode)) {}
+
+inline ThreadPoolOptions ThreadPool::make_options(size_t min_threads,
+                                                  size_t max_threads,
+                                                  ThreadPoolMode mode) {
+  ThreadPoolOptions options;
+  options.min_threads = min_threads;
+  options.max_threads = max_threads;
+  options.mode = mode;
+  return options;
+}
+
+inline ThreadPool::ThreadPool(const ThreadPoolOptions& options)
+    : mode(options.mode)
+    , min_threads(options.min_threads)
+    , max_threads(std::max(options.min_threads, options.max_threads))
+    , name_prefix(options.name_prefix)
+    , collect_stats(options.collect_stats)
+    , capacity(options.queue_capacity)
+    , overflow(options.overflow)
+    , grow_latency(options.grow_latency)
+    , idle_timeout(options.idle_timeout)
+    , live(0)
+    , grow_at(TimePoint::max())
+    , pending(0)
+    , high_pending(0)
+    , peak_pending(0)
+    , wake_cursor(0)
+    , sleepers(0)
+    , stop(false)
+    , blocked(0)
+    , discard(false) {
+  for (Lane& lane : lanes) {
+    lane.head = nullptr;
+    lane.tail = nullptr;
+    lane.skipped = 0;
+    memset(&lane.stats, 0, sizeof(lane.stats));
+  }
+
+  std::vector<CpuInfo> topology;
+  std::vector<CpuInfo> pins;
+  if (options.affinity != ThreadPoolAffinity::kNone)
+    topology = GetCpuTopology();
+  if (options.affinity == ThreadPoolAffinity::kCpuSet) {
+    for (int cpu : options.cpus) {
+      CpuInfo info = {cpu, cpu, 0, 0};
+      for (const CpuInfo& known : topology) {
+        if (known.cpu == cpu)
+          info = known;
       }
-    });
+      pins.push_back(info);
+    }
+  }
+  else if (options.affinity == ThreadPoolAffinity::kPhysicalCores) {
+    pins = GetPhysicalCores();
+    if (options.min_threads == 0 && options.max_threads == 0) {
+      min_threads = pins.size();
+      max_threads = pins.size();
+    }
+  }
+
+  workers.resize(max_threads);
+  for (size_t i = 0; i < max_threads; ++i) {
+    queues.emplace_back(new Worker());
+    Worker& worker = *queues.back();
+    worker.rng = static_cast<uint32_t>(i * 2654435761u + 1);
+    worker.ticks = 0;
+    worker.running = false;
+    worker.cpu = pins.empty() ? -1 : pins[i % pins.size()].cpu;
+    if (collect_stats)
+      worker.stats.reset(new WorkerStats());
+    int node = pins.empty() || !options.numa_groups ? 0 : pins[i % pins.size()].node;
+
+    worker.group = groups.size();
+    for (size_t g = 0; g < groups.size(); g++) {
+      if (groups[g]->node == node)
+        worker.group = g;
+    }
+    if (worker.group == groups.size()) {
+      groups.emplace_back(new Group());
+      groups.back()->node = node;
+      groups.back()->parked = 0;
+      groups.back()->head = nullptr;
+      groups.back()->tail = nullptr;
+    }
+  }
+  if (groups.empty()) {
+    groups.emplace_back(new Group());
+    groups.back()->node = 0;
+    groups.back()->parked = 0;
+    groups.back()->head = nullptr;
+    groups.back()->tail = nullptr;
+  }
+
+  std::unique_lock<std::mutex> lock(queue_mutex);
+  for (size_t i = 0; i < min_threads; ++i)
+    start_worker_locked(i);
+  if (elastic())
+    supervisor = std::thread([this] { supervise(); });
+}
+
+inline void ThreadPool::set_grow_latency(std::chrono::microseconds latency) {
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  grow_latency = latency;
+}
+
+inline void ThreadPool::set_idle_timeout(std::chrono::milliseconds timeout) {
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  idle_timeout = timeout;
 }
 
 // add new work item to the pool
@@ -62,32 +576,920 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
   using return_type = typename std::result_of<F(Args...)>::type;
 
-  auto task = std::make_shared<std::packaged_task<return_type()>>(
-      std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+  std::future<return_type> res;
+  Task task = MakeFutureTask(&res, std::forward<F>(f), std::forward<Args>(args)...);
+  submit(std::move(task));
+  return res;
+}
+
+template <class F, class... Args>
+auto ThreadPool::async(F&& f, Args&&... args)
+    -> Future<typename std::result_of<F(Args...)>::type> {
+  using return_type = typename std::result_of<F(Args...)>::type;
+  typedef decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...)) Call;
+
+  Promise<return_type> promise;
+  Future<return_type> res = promise.get_future();
+  submit(Task(internal::FulfilCall<return_type, Call>(
+      std::bind(std::forward<F>(f), std::forward<Args>(args)...), std::move(promise))));
+  return res;
+}
+
+template <class F, class... Args>
+auto ThreadPool::enqueue_with_priority(TaskPriority priority, F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+  return enqueue_with_deadline(priority, TimePoint::max(), std::forward<F>(f),
+                               std::forward<Args>(args)...);
+}
+
+template <class F, class... Args>
+auto ThreadPool::enqueue_with_deadline(TaskPriority priority,
+                                       std::chrono::steady_clock::time_point deadline,
+                                       F&& f,
+                                       Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+  using return_type = typename std::result_of<F(Args...)>::type;
+
+  std::future<return_type> res;
+  Task task = MakeFutureTask(&res, std::forward<F>(f), std::forward<Args>(args)...);
+  submit_to_lane(std::move(task), static_cast<size_t>(priority), deadline);
+  return res;
+}
+
+template <class F>
+void ThreadPool::post(F&& f) {
+  submit(Task(std::forward<F>(f)));
+}
+
+template <class F, class... Args>
+auto ThreadPool::try_enqueue(F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+  using return_type = typename std::result_of<F(Args...)>::type;
+
+  std::future<return_type> res;
+  Task task = MakeFutureTask(&res, std::forward<F>(f), std::forward<Args>(args)...);
+  if (!submit(std::move(task), true))
+    return std::future<return_type>();
+  return res;
+}
+
+template <class F>
+bool ThreadPool::try_post(F&& f) {
+  return submit(Task(std::forward<F>(f)), true);
+}
+
+template <class F, class Arg, class... Args>
+void ThreadPool::post(F&& f, Arg&& arg, Args&&... args) {
+  submit(Task(std::bind(std::forward<F>(f), std::forward<Arg>(arg), std::forward<Args>(args)...)));
+}
+
+inline bool ThreadPool::submit(Task&& task, bool try_only) {
+  size_t self = current_worker();
+
+  // don't allow enqueueing after stopping the pool, except from the tasks being drained
+  if (stop.load(std::memory_order_relaxed) && self == size_t(-1))
+    throw std::runtime_error("enqueue on stopped ThreadPool");
+
+  TaskNode* node = nodes.newElement(std::move(task));
+  if (mode == ThreadPoolMode::kWorkStealing && self != size_t(-1)) {
+    if (collect_stats)
+      stamp(node);
+    queues[self]->local.Push(node);
+    // Pairs with the fence in run(): either a parking worker sees the task, or we see it parked.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) != 0)
+      wake_one();
+    return true;
+  }
 
-  std::future<return_type> res = task->get_future();
+  stamp(node);
   {
     std::unique_lock<std::mutex> lock(queue_mutex);
+    if (self == size_t(-1) && !admit_locked(lock, 1, try_only)) {
+      lock.unlock();
+      nodes.deleteElement(node);
+      if (try_only)
+        return false;
+      reject();
+    }
+    push_locked(static_cast<size_t>(TaskPriority::kNormal), node, node, 1);
+    grow_locked();
+  }
+  notify(size_t(-1));
+  return true;
+}
 
-    // don't allow enqueueing after stopping the pool
-    if (stop)
-      throw std::runtime_error("enqueue on stopped ThreadPool");
+inline void ThreadPool::submit_to_lane(Task&& task, size_t lane, TimePoint deadline) {
+  bool outside = current_worker() == size_t(-1);
+  if (stop.load(std::memory_order_relaxed) && outside)
+    throw std::runtime_error("enqueue on stopped ThreadPool");
 
-    tasks.emplace([task]() { (*task)(); });
+  TaskNode* node = nodes.newElement(std::move(task));
+  node->deadline = deadline;
+  stamp(node);
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (outside && !admit_locked(lock, 1, false)) {
+      lock.unlock();
+      nodes.deleteElement(node);
+      reject();
+    }
+    if (deadline == TimePoint::max()) {
+      push_locked(lane, node, node, 1);
+    }
+    else {
+      std::vector<TaskNode*>& heap = lanes[lane].deadlines;
+      heap.push_back(node);
+      std::push_heap(heap.begin(), heap.end(),
+                     [](TaskNode* a, TaskNode* b) { return a->deadline > b->deadline; });
+      push_locked(lane, nullptr, nullptr, 1);
+    }
+    grow_locked();
   }
-  condition.notify_one();
+  notify(size_t(-1));
+}
+
+inline void ThreadPool::submit_to_node(Task&& task, int node) {
+  size_t group = size_t(-1);
+  if (groups.size() > 1) {
+    for (size_t g = 0; g < groups.size(); g++) {
+      if (groups[g]->node == node)
+        group = g;
+    }
+  }
+  if (group == size_t(-1)) {
+    submit(std::move(task));
+    return;
+  }
+
+  bool outside = current_worker() == size_t(-1);
+  if (stop.load(std::memory_order_relaxed) && outside)
+    throw std::runtime_error("enqueue on stopped ThreadPool");
+
+  TaskNode* node_task = nodes.newElement(std::move(task));
+  stamp(node_task);
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (outside && !admit_locked(lock, 1, false)) {
+      lock.unlock();
+      nodes.deleteElement(node_task);
+      reject();
+    }
+    Group& g = *groups[group];
+    if (g.tail)
+      g.tail->next = node_task;
+    else
+      g.head = node_task;
+    g.tail = node_task;
+    size_t depth = pending.fetch_add(1, std::memory_order_relaxed) + 1;
+    peak_pending = std::max(peak_pending, depth);
+    grow_locked();
+  }
+  notify(group);
+}
+
+template <class F, class... Args>
+auto ThreadPool::enqueue_on_node(int node, F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+  using return_type = typename std::result_of<F(Args...)>::type;
+
+  std::future<return_type> res;
+  Task task = MakeFutureTask(&res, std::forward<F>(f), std::forward<Args>(args)...);
+  submit_to_node(std::move(task), node);
   return res;
 }
 
-// the destructor joins all threads
-inline ThreadPool::~ThreadPool() {
+template <class F>
+void ThreadPool::post_on_node(int node, F&& f) {
+  submit_to_node(Task(std::forward<F>(f)), node);
+}
+
+inline bool ThreadPool::admit_locked(std::unique_lock<std::mutex>& lock, size_t n, bool try_only) {
+  if (capacity == 0)
+    return true;
+  // A batch larger than the whole queue goes in once the queue is empty.
+  auto room = [this, n] {
+    size_t depth = pending.load(std::memory_order_relaxed);
+    return depth + n <= capacity || depth == 0;
+  };
+  if (room())
+    return true;
+  if (try_only || overflow == ThreadPoolOverflow::kReject)
+    return false;
+  blocked++;
+  space.wait(lock, [this, &room] { return stop || room(); });
+  blocked--;
+  return !stop;
+}
+
+inline void ThreadPool::reject() const {
+  if (stop.load(std::memory_order_relaxed))
+    throw std::runtime_error("enqueue on stopped ThreadPool");
+  throw std::runtime_error("ThreadPool queue is full");
+}
+
+inline ThreadPool::TaskNode* ThreadPool::unlink_all_locked() {
+  TaskNode* list = nullptr;
+  auto take = [&list](TaskNode* node) {
+    node->next = list;
+    list = node;
+  };
+  for (Lane& l : lanes) {
+    for (TaskNode* node = l.head; node;) {
+      TaskNode* next = node->next;
+      take(node);
+      node = next;
+    }
+    for (TaskNode* node : l.deadlines)
+      take(node);
+    l.head = nullptr;
+    l.tail = nullptr;
+    l.deadlines.clear();
+    l.stats.depth = 0;
+  }
+  for (const std::unique_ptr<Group>& g : groups) {
+    for (TaskNode* node = g->head; node;) {
+      TaskNode* next = node->next;
+      take(node);
+      node = next;
+    }
+    g->head = nullptr;
+    g->tail = nullptr;
+  }
+  pending.store(0, std::memory_order_relaxed);
+  high_pending.store(0, std::memory_order_relaxed);
+  return list;
+}
+
+inline void ThreadPool::drop(TaskNode* head) {
+  while (head) {
+    TaskNode* next = head->next;
+    nodes.deleteElement(head);
+    head = next;
+  }
+}
+
+inline void ThreadPool::push_locked(size_t lane, TaskNode* head, TaskNode* tail, size_t n) {
+  Lane& l = lanes[lane];
+  if (head) {
+    if (l.tail)
+      l.tail->next = head;
+    else
+      l.head = head;
+    l.tail = tail;
+  }
+  l.stats.enqueued += n;
+  l.stats.depth += n;
+  l.stats.max_depth = std::max(l.stats.max_depth, l.stats.depth);
+  size_t depth = pending.fetch_add(n, std::memory_order_relaxed) + n;
+  peak_pending = std::max(peak_pending, depth);
+  if (lane == static_cast<size_t>(TaskPriority::kHigh))
+    high_pending.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline ThreadPool::TaskNode* ThreadPool::pop_locked() {
+  size_t chosen = kLaneCount;
+  for (size_t i = 0; i < kLaneCount; i++) {
+    if (lanes[i].stats.depth != 0) {
+      chosen = i;
+      break;
+    }
+  }
+  if (chosen == kLaneCount)
+    return nullptr;
+
+  // The lowest starving lane goes first, the non-empty lanes below the served one are passed
+  // over.
+  for (size_t i = kLaneCount - 1; i > chosen; i--) {
+    if (lanes[i].stats.depth != 0 && lanes[i].skipped >= kAgingLimit) {
+      chosen = i;
+      lanes[i].stats.aged++;
+      break;
+    }
+  }
+  for (size_t i = chosen + 1; i < kLaneCount; i++) {
+    if (lanes[i].stats.depth != 0)
+      lanes[i].skipped++;
+  }
+
+  Lane& l = lanes[chosen];
+  l.skipped = 0;
+  TaskNode* node = nullptr;
+  if (!l.deadlines.empty()) {
+    std::pop_heap(l.deadlines.begin(), l.deadlines.end(),
+                  [](TaskNode* a, TaskNode* b) { return a->deadline > b->deadline; });
+    node = l.deadlines.back();
+    l.deadlines.pop_back();
+    if (node->deadline < std::chrono::steady_clock::now())
+      l.stats.deadline_misses++;
+  }
+  else {
+    node = l.head;
+    l.head = node->next;
+    if (l.head == nullptr)
+      l.tail = nullptr;
+    node->next = nullptr;
+  }
+
+  l.stats.depth--;
+  l.stats.dequeued++;
+  pending.fetch_sub(1, std::memory_order_relaxed);
+  if (chosen == static_cast<size_t>(TaskPriority::kHigh))
+    high_pending.fetch_sub(1, std::memory_order_relaxed);
+  if (blocked != 0)
+    space.notify_all();
+  return node;
+}
+
+inline void ThreadPool::stamp(TaskNode* head) const {
+  if (!elastic() && !collect_stats)
+    return;
+  TimePoint now = std::chrono::steady_clock::now();
+  for (TaskNode* node = head; node; node = node->next)
+    node->enqueued = now;
+}
+
+inline uint64_t ThreadPool::to_ns(TimePoint::duration d) {
+  int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  return ns > 0 ? static_cast<uint64_t>(ns) : 0;
+}
+
+inline void ThreadPool::grow_locked() {
+  if (!elastic() || stop || pending.load(std::memory_order_relaxed) == 0 ||
+      live.load(std::memory_order_relaxed) >= max_threads)
+    return;
+  // Nobody would ever take the tasks.
+  if (live.load(std::memory_order_relaxed) == 0) {
+    for (size_t i = 0; i < max_threads; i++) {
+      if (!queues[i]->running) {
+        start_worker_locked(i);
+        return;
+      }
+    }
+  }
+  if (sleepers.load(std::memory_order_relaxed) != 0)
+    return;
+
+  TimePoint oldest = TimePoint::max();
+  for (const Lane& l : lanes) {
+    if (l.head)
+      oldest = std::min(oldest, l.head->enqueued);
+    if (!l.deadlines.empty())
+      oldest = std::min(oldest, l.deadlines.front()->enqueued);
+  }
+  for (const std::unique_ptr<Group>& g : groups) {
+    if (g->head)
+      oldest = std::min(oldest, g->head->enqueued);
+  }
+  if (oldest == TimePoint::max())
+    return;
+  if (std::chrono::steady_clock::now() - oldest < grow_latency) {
+    // Check again once it is due, whether or not anything else happens until then.
+    TimePoint due = oldest + grow_latency;
+    if (due < grow_at) {
+      grow_at = due;
+      grow_wakeup.notify_one();
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < max_threads; i++) {
+    if (!queues[i]->running) {
+      start_worker_locked(i);
+      return;
+    }
+  }
+}
+
+inline void ThreadPool::start_worker_locked(size_t slot) {
+  // The thread that retired from this slot is done with the lock and about to exit.
+  if (workers[slot].joinable())
+    workers[slot].join();
+  queues[slot]->running = true;
+  live.fetch_add(1, std::memory_order_relaxed);
+  try {
+    workers[slot] = std::thread([this, slot] { run(slot); });
+  } catch (const std::system_error&) {
+    // Growing is best effort, the task is queued either way.
+    queues[slot]->running = false;
+    live.fetch_sub(1, std::memory_order_relaxed);
+    if (slot < min_threads)
+      throw;
+  }
+}
+
+inline void ThreadPool::supervise() {
+  std::unique_lock<std::mutex> lock(queue_mutex);
+  while (!stop) {
+    if (grow_at == TimePoint::max())
+      grow_wakeup.wait(lock);
+    else
+      grow_wakeup.wait_until(lock, grow_at);
+    if (stop || std::chrono::steady_clock::now() < grow_at)
+      continue;
+    // Re-armed by grow_locked() if the queue isn't due yet.
+    grow_at = TimePoint::max();
+    try {
+      grow_locked();
+    } catch (const std::system_error&) {
+      // Growing is best effort, the next submission tries again.
+    }
+  }
+}
+
+inline ThreadPool::TaskNode* ThreadPool::pop_group_locked(size_t group) {
+  for (size_t g = 0; g < groups.size(); g++) {
+    Group& q = *groups[g];
+    if ((group != size_t(-1) && g != group) || q.head == nullptr)
+      continue;
+    TaskNode* node = q.head;
+    q.head = node->next;
+    if (q.head == nullptr)
+      q.tail = nullptr;
+    node->next = nullptr;
+    pending.fetch_sub(1, std::memory_order_relaxed);
+    if (blocked != 0)
+      space.notify_all();
+    return node;
+  }
+  return nullptr;
+}
+
+inline ThreadPoolLaneStats ThreadPool::lane_stats(TaskPriority priority) {
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  return lanes[static_cast<size_t>(priority)].stats;
+}
+
+inline ThreadPoolStats ThreadPool::stats() {
+  ThreadPoolStats result = ThreadPoolStats();
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    result.peak_queue_depth = peak_pending;
+  }
+  result.workers = size();
+  result.queue_depth = pending.load(std::memory_order_relaxed);
+  uint64_t busy = 0;
+  uint64_t idle = 0;
+  for (const std::unique_ptr<Worker>& worker : queues) {
+    result.queue_depth += worker->local.Size();
+    const WorkerStats* counters = worker->stats.get();
+    if (!counters)
+      continue;
+    result.tasks += counters->tasks.load(std::memory_order_relaxed);
+    result.steals += counters->steals.load(std::memory_order_relaxed);
+    result.parks += counters->parks.load(std::memory_order_relaxed);
+    busy += counters->busy_ns.load(std::memory_order_relaxed);
+    idle += counters->idle_ns.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < ThreadPoolStats::kBuckets; i++) {
+      result.wait_histogram[i] += counters->wait[i].load(std::memory_order_relaxed);
+      result.run_histogram[i] += counters->run[i].load(std::memory_order_relaxed);
+    }
+  }
+  result.busy = std::chrono::nanoseconds(busy);
+  result.idle = std::chrono::nanoseconds(idle);
+  return result;
+}
+
+inline void ThreadPool::wake_one() {
+  // Taking the lock orders the notification after the parking worker's last check.
+  { std::lock_guard<std::mutex> lock(queue_mutex); }
+  notify(size_t(-1));
+}
+
+inline void ThreadPool::wake(size_t n) {
+  size_t parked = sleepers.load(std::memory_order_relaxed);
+  if (n >= parked) {
+    for (const std::unique_ptr<Group>& g : groups)
+      g->condition.notify_all();
+    return;
+  }
+  while (n--)
+    notify(size_t(-1));
+}
+
+// Called after the task was queued under queue_mutex: a worker that parked before that is counted
+// in `parked`, one that parks later sees the task.
+inline void ThreadPool::notify(size_t group) {
+  if (groups.size() == 1) {
+    groups[0]->condition.notify_one();
+    return;
+  }
+  if (group != size_t(-1) && groups[group]->parked.load(std::memory_order_relaxed) != 0) {
+    groups[group]->condition.notify_one();
+    return;
+  }
+  size_t start = wake_cursor.fetch_add(1, std::memory_order_relaxed);
+  for (size_t i = 0; i < groups.size(); i++) {
+    Group& g = *groups[(start + i) % groups.size()];
+    if (g.parked.load(std::memory_order_relaxed) != 0) {
+      g.condition.notify_one();
+      return;
+    }
+  }
+}
+
+template <class ForwardIt>
+void ThreadPool::enqueue_bulk(ForwardIt first, ForwardIt last) {
+  static_assert(std::is_base_of<std::forward_iterator_tag,
+                                typename std::iterator_traits<ForwardIt>::iterator_category>::value,
+                "enqueue_bulk needs forward iterators");
+  submit_bulk(static_cast<size_t>(std::distance(first, last)),
+              [&first](size_t) { return Task(*first++); });
+}
+
+template <class Make>
+bool ThreadPool::submit_bulk(size_t n, Make make, bool try_only) {
+  if (n == 0)
+    return true;
+
+  size_t self = current_worker();
+  if (stop.load(std::memory_order_relaxed) && self == size_t(-1))
+    throw std::runtime_error("enqueue on stopped ThreadPool");
+
+  if (mode == ThreadPoolMode::kWorkStealing && self != size_t(-1)) {
+    for (size_t i = 0; i < n; i++) {
+      TaskNode* node = nodes.newElement(make(i));
+      if (collect_stats)
+        stamp(node);
+      queues[self]->local.Push(node);
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) != 0) {
+      { std::lock_guard<std::mutex> lock(queue_mutex); }
+      wake(n);
+    }
+    return true;
+  }
+
+  // Link the batch outside the lock, then splice it in.
+  TaskNode* head = nodes.newElement(make(0));
+  TaskNode* tail = head;
+  for (size_t i = 1; i < n; i++) {
+    tail->next = nodes.newElement(make(i));
+    tail = tail->next;
+  }
+  stamp(head);
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (self == size_t(-1) && !admit_locked(lock, n, try_only)) {
+      lock.unlock();
+      drop(head);
+      if (try_only)
+        return false;
+      reject();
+    }
+    push_locked(static_cast<size_t>(TaskPriority::kNormal), head, tail, n);
+    grow_locked();
+  }
+  wake(n);
+  return true;
+}
+
+namespace internal {
+// Shared by the participants of one parallel_for/parallel_reduce call.
+template <class Index>
+struct ParallelRange {
+  ParallelRange(Index begin, Index end, Index grain, size_t participants)
+      : next(begin), end(end), grain(grain), participants(participants), busy(0) {}
+
+  // Claims the next chunk, false once the range is exhausted. On success the caller must call
+  // Release() when it is done with the chunk.
+  bool Claim(Index* b, Index* e) {
+    busy.fetch_add(1, std::memory_order_acq_rel);
+    Index cur = next.load(std::memory_order_relaxed);
+    for (;;) {
+      if (cur >= end) {
+        Release();
+        return false;
+      }
+      Index remaining = end - cur;
+      Index chunk = static_cast<Index>(remaining / (2 * participants));
+      chunk = std::min(std::max(chunk, grain), remaining);
+      if (next.compare_exchange_weak(cur, cur + chunk, std::memory_order_relaxed)) {
+        *b = cur;
+        *e = cur + chunk;
+        return true;
+      }
+    }
+  }
+
+  void Release() {
+    if (busy.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> lock(mutex);
+      cond.notify_all();
+    }
+  }
+
+  void Fail(std::exception_ptr e) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error)
+      error = e;
+    next.store(end, std::memory_order_relaxed);
+  }
+
+  // Returns once the range is exhausted and no chunk is being processed.
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this] { return busy.load(std::memory_order_acquire) == 0; });
+  }
+
+  std::atomic<Index> next;
+  const Index end;
+  const Index grain;
+  const size_t participants;
+  std::atomic<size_t> busy;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::exception_ptr error;
+};
+
+template <class Index, class Body>
+void RunChunks(ParallelRange<Index>& range, Body& body) {
+  Index b, e;
+  while (range.Claim(&b, &e)) {
+    try {
+      body(b, e);
+    } catch (...) {
+      range.Fail(std::current_exception());
+    }
+    range.Release();
+  }
+}
+}  // namespace internal
+
+template <class Index, class Body>
+void ThreadPool::parallel_chunks(Index begin, Index end, Index grain, Body& body) {
+  if (begin >= end)
+    return;
+  if (grain < 1)
+    grain = 1;
+
+  bool inside = current_worker() != size_t(-1);
+  size_t participants = size() + (inside ? 0 : 1);
+  if (participants == 0)
+    participants = 1;
+  size_t chunks = static_cast<size_t>((end - begin + grain - 1) / grain);
+  size_t helpers = std::min(participants - 1, chunks - 1);
+
+  // A helper may only get to run after the call returned. It then finds the range exhausted and
+  // never touches `body`, but it still needs the range.
+  std::shared_ptr<internal::ParallelRange<Index>> range =
+      std::make_shared<internal::ParallelRange<Index>>(begin, end, grain, participants);
+  if (helpers > 0) {
+    // Without room in a bounded queue the calling thread does the work alone.
+    auto helper = [range, &body]() { internal::RunChunks(*range, body); };
+    submit_bulk(helpers, [&helper](size_t) { return Task(helper); }, true);
+  }
+
+  internal::RunChunks(*range, body);
+  range->Wait();
+  if (range->error)
+    std::rethrow_exception(range->error);
+}
+
+template <class Index, class Fn>
+void ThreadPool::parallel_for(Index begin, Index end, Index grain, Fn fn) {
+  auto body = [&fn](Index b, Index e) {
+    for (Index i = b; i < e; ++i)
+      fn(i);
+  };
+  parallel_chunks(begin, end, grain, body);
+}
+
+template <class Index, class Fn>
+void ThreadPool::parallel_for_chunks(Index begin, Index end, Index grain, Fn fn) {
+  parallel_chunks(begin, end, grain, fn);
+}
+
+template <class Index, class T, class Fn, class Combine>
+T ThreadPool::parallel_reduce(Index begin,
+                              Index end,
+                              Index grain,
+                              T identity,
+                              Fn fn,
+                              Combine combine) {
+  T result = identity;
+  std::mutex result_mutex;
+  auto body = [&](Index b, Index e) {
+    T partial = fn(b, e, identity);
+    std::lock_guard<std::mutex> lock(result_mutex);
+    result = combine(std::move(result), std::move(partial));
+  };
+  parallel_chunks(begin, end, grain, body);
+  return result;
+}
+
+inline ThreadPool::TaskNode* ThreadPool::find_task(size_t self) {
+  Worker& worker = *queues[self];
+  TaskNode* task = nullptr;
+
+  // Look at the injection queue now and then, so that tasks spawning tasks can't starve it.
+  bool local_first =
+      ++worker.ticks % 61 != 0 && high_pending.load(std::memory_order_relaxed) == 0;
+  if (local_first && worker.local.Pop(&task))
+    return task;
+
+  if (pending.load(std::memory_order_relaxed) != 0) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    task = pop_group_locked(worker.group);
+    if (!task)
+      task = pop_locked();
+    if (task) {
+      grow_locked();
+      return task;
+    }
+  }
+
+  if (!local_first && worker.local.Pop(&task))
+    return task;
+
+  if (steal(self, true, &task))
+    return task;
+  if (groups.size() > 1) {
+    // Nothing left near us, help the other nodes.
+    if (steal(self, false, &task))
+      return task;
+    if (pending.load(std::memory_order_relaxed) != 0) {
+      std::unique_lock<std::mutex> lock(queue_mutex);
+      task = pop_group_locked(size_t(-1));
+    }
+  }
+  return task;
+}
+
+// Steals from the other workers of our group, or of the other groups, starting at a random one.
+inline bool ThreadPool::steal(size_t self, bool own_group, TaskNode** task) {
+  Worker& worker = *queues[self];
+  size_t n = queues.size();
+  worker.rng ^= worker.rng << 13;
+  worker.rng ^= worker.rng >> 17;
+  worker.rng ^= worker.rng << 5;
+  size_t start = worker.rng % n;
+  for (size_t i = 0; i < n; i++) {
+    size_t victim = (start + i) % n;
+    if (victim == self || (queues[victim]->group == worker.group) != own_group)
+      continue;
+    if (queues[victim]->local.Steal(task)) {
+      if (worker.stats)
+        count(worker.stats->steals, 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool ThreadPool::has_work() const {
+  if (pending.load(std::memory_order_relaxed) != 0)
+    return true;
+  for (const std::unique_ptr<Worker>& worker : queues) {
+    if (!worker->local.Empty())
+      return true;
+  }
+  return false;
+}
+
+inline bool ThreadPool::spin() const {
+  for (size_t round = 0; round < kSpinRounds; round++) {
+    if (round < kPauseRounds) {
+      for (size_t i = 0; i < (size_t(1) << round); i++) {
+#ifdef AKALI_THREAD_POOL_HAS_PAUSE
+        _mm_pause();
+#else
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+      }
+    }
+    else {
+      std::this_thread::yield();
+    }
+    if (has_work())
+      return true;
+    if (stop.load(std::memory_order_relaxed))
+      return false;
+  }
+  return false;
+}
+
+inline void ThreadPool::run(size_t self) {
+  tls_pool() = this;
+  tls_index() = self;
+  Group& group = *groups[queues[self]->group];
+#if defined AKALI_WIN || defined AKALI_LINUX
+  if (!name_prefix.empty())
+    Thread::SetCurrentThreadName((name_prefix + std::to_string(self)).c_str());
+#endif
+  if (queues[self]->cpu >= 0)
+    SetCurrentThreadAffinity(std::vector<int>(1, queues[self]->cpu));
+
+  // Time between tasks counts as idle, searching and spinning included.
+  WorkerStats* counters = queues[self]->stats.get();
+  TimePoint idle_since;
+  if (counters)
+    idle_since = std::chrono::steady_clock::now();
+
+  for (;;) {
+    TaskNode* node = find_task(self);
+    if (node && discard.load(std::memory_order_relaxed)) {
+      nodes.deleteElement(node);
+      continue;
+    }
+    if (node) {
+      if (counters) {
+        TimePoint start = std::chrono::steady_clock::now();
+        count(counters->idle_ns, to_ns(start - idle_since));
+        count(counters->wait[Log2Bucket(to_ns(start - node->enqueued))], 1);
+        node->task();
+        idle_since = std::chrono::steady_clock::now();
+        uint64_t ran = to_ns(idle_since - start);
+        count(counters->busy_ns, ran);
+        count(counters->run[Log2Bucket(ran)], 1);
+        count(counters->tasks, 1);
+      }
+      else {
+        node->task();
+      }
+      nodes.deleteElement(node);
+      continue;
+    }
+    if (spin())
+      continue;
+
+    std::unique_lock<std::mutex> lock(this->queue_mutex);
+    sleepers.fetch_add(1, std::memory_order_relaxed);
+    group.parked.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto ready = [this] { return this->stop || this->has_work(); };
+    if (counters && !ready())
+      count(counters->parks, 1);
+    bool woken = true;
+    if (elastic())
+      woken = group.condition.wait_for(lock, idle_timeout, ready);
+    else
+      group.condition.wait(lock, ready);
+    group.parked.fetch_sub(1, std::memory_order_relaxed);
+    sleepers.fetch_sub(1, std::memory_order_relaxed);
+    if (this->stop && !this->has_work())
+      break;
+    // Idle for idle_timeout, every deque including ours is empty.
+    if (!woken && live.load(std::memory_order_relaxed) > min_threads) {
+      queues[self]->running = false;
+      live.fetch_sub(1, std::memory_order_relaxed);
+      break;
+    }
+  }
+
+  if (counters)
+    count(counters->idle_ns, to_ns(std::chrono::steady_clock::now() - idle_since));
+  tls_pool() = nullptr;
+}
+
+inline size_t ThreadPool::current_worker() const {
+  return tls_pool() == this ? tls_index() : size_t(-1);
+}
+
+inline const ThreadPool*& ThreadPool::tls_pool() {
+  static thread_local const ThreadPool* pool = nullptr;
+  return pool;
+}
+
+inline size_t& ThreadPool::tls_index() {
+  static thread_local size_t index = 0;
+  return index;
+}
+
+inline void ThreadPool::shutdown(ThreadPoolShutdown how) {
+  std::vector<std::thread> threads;
+  std::thread supervising;
+  TaskNode* dropped = nullptr;
   {
     std::unique_lock<std::mutex> lock(queue_mutex);
     stop = true;
+    if (how == ThreadPoolShutdown::kDiscardPending) {
+      discard = true;
+      cancellation.cancel();
+      dropped = unlink_all_locked();
+    }
+    // no worker is started after this
+    threads.swap(workers);
+    supervising.swap(supervisor);
   }
-  condition.notify_all();
-  for (std::thread& worker : workers)
-    worker.join();
+  space.notify_all();
+  grow_wakeup.notify_one();
+  if (supervising.joinable())
+    supervising.join();
+  for (const std::unique_ptr<Group>& g : groups)
+    g->condition.notify_all();
+  // Destroying a task may fulfil a promise and run its continuations, so not under the lock.
+  drop(dropped);
+  for (std::thread& worker : threads) {
+    if (worker.joinable())
+      worker.join();
+  }
+}
+
+// the destructor runs the remaining tasks and joins all threads
+inline ThreadPool::~ThreadPool() {
+  shutdown(ThreadPoolShutdown::kDrain);
 }
 }  // namespace akali
 
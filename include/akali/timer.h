@@ -18,14 +18,19 @@
 
 #include "akali/akali_export.h"
 
+#if defined AKALI_WIN || defined AKALI_LINUX
 #ifdef AKALI_WIN
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
 #endif
 #include <windows.h>
+#endif
+#include <stddef.h>
 #include <functional>
+#include <memory>
 
 namespace akali {
+#ifdef AKALI_WIN
 class AKALI_API TimerBase {
  public:
   TimerBase();
@@ -46,16 +51,54 @@ class AKALI_API TimerBase {
   HANDLE m_hTimer;
   PTP_TIMER m_pTimer;
 };
+#else
+namespace internal {
+struct TimerEntry;
+}
+
+// All timers of the process share one thread, it waits on their timerfds with epoll. Callbacks
+// run on that thread unless an executor is set, a slow callback then delays the other timers.
+// Expirations missed while a callback was busy are coalesced into one call.
+class AKALI_API TimerBase {
+ public:
+  // Runs a callback elsewhere, e.g. [&pool](std::function<void()> f) { pool.post(std::move(f)); }
+  // It must eventually run every callback it is given, Stop(true) waits for them, so don't
+  // Stop(true) from another task of a single threaded executor. If it throws, the tick is
+  // dropped.
+  typedef std::function<void(std::function<void()>)> Executor;
+
+  TimerBase();
+  // Stops the timer and waits for its callbacks. A derived class whose OnTimedEvent uses its own
+  // members should Stop(true) in its destructor.
+  virtual ~TimerBase();
+
+  // Before Start(), applies to the next Start().
+  void SetExecutor(Executor executor);
+
+  bool Start(unsigned int ulInterval,  // ulInterval in ms
+             bool bImmediately,
+             bool bOnce);
+  // bWait waits for callbacks in progress, except when called from the timer's own callback.
+  void Stop(bool bWait);
+  virtual void OnTimedEvent();
+
+ private:
+  std::shared_ptr<internal::TimerEntry> m_entry;
+  Executor m_executor;
+};
+#endif
 
 template <class T>
 class TTimer : public TimerBase {
  public:
-  typedef private void (T::*POnTimer)(void);
+  typedef void (T::*POnTimer)(void);
 
   TTimer() {
     m_pClass = NULL;
     m_pfnOnTimer = NULL;
   }
+  // before the vptr and the members go, a callback may be running
+  ~TTimer() { Stop(true); }
 
   void SetTimedEvent(T* pClass, POnTimer pFunc) {
     m_pClass = pClass;
@@ -80,6 +123,8 @@ class AKALI_API Timer : public TimerBase {
   Timer() {}
 
   Timer(FN_CB cb) { SetTimedEvent(cb); }
+  // before m_cb goes, a callback may be running
+  ~Timer() { Stop(true); }
 
   void SetTimedEvent(FN_CB cb) { m_cb = cb; }
 
@@ -94,5 +139,5 @@ class AKALI_API Timer : public TimerBase {
   FN_CB m_cb;
 };
 }  // namespace akali
-#endif
+#endif  // AKALI_WIN || AKALI_LINUX
 #endif  // !AKALI_WIN_TIMER_H_
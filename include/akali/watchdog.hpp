@@ -0,0 +1,133 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_WATCHDOG_H_
+#define AKALI_WATCHDOG_H_
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "akali/constructormagic.h"
+#include "akali/location.h"
+#include "akali/thread.hpp"
+
+/*
+Watchdog finds akali::Threads stuck in a task.
+
+Watch() turns on the thread's task tracking: before each task the thread publishes the task's
+start time and the Location it was posted from (Thread::InvokeFrom/PostFrom with AKALI_FROM_HERE),
+a few relaxed stores. A monitor thread wakes every period, reads that state without locking and
+calls the handler once for every task that has been running longer than the threshold.
+
+The handler runs on the monitor thread, it must not block for long and must not call Watch(),
+Unwatch() or destroy the Watchdog. Unwatch() a thread before destroying it.
+*/
+
+namespace akali {
+struct HangReport {
+  std::string thread_name;
+  long thread_id;
+  Location posted_from;
+  // how long the task had been running when it was found
+  std::chrono::nanoseconds running;
+};
+
+class Watchdog {
+ public:
+  typedef std::function<void(const HangReport&)> Handler;
+
+  // checks every threshold / 4
+  Watchdog(std::chrono::nanoseconds threshold, Handler handler)
+      : Watchdog(threshold, threshold / 4, std::move(handler)) {}
+
+  Watchdog(std::chrono::nanoseconds threshold, std::chrono::nanoseconds period, Handler handler)
+      : threshold_(threshold)
+      , period_(std::max(period, std::chrono::nanoseconds(std::chrono::milliseconds(1))))
+      , handler_(std::move(handler))
+      , exit_(false) {
+    monitor_ = std::thread(&Watchdog::Monitor, this);
+  }
+
+  ~Watchdog() {
+    {
+      std::lock_guard<std::mutex> lg(mutex_);
+      exit_ = true;
+    }
+    wakeup_.notify_one();
+    monitor_.join();
+  }
+
+  void Watch(Thread* thread) {
+    thread->EnableTaskTracking(true);
+    std::lock_guard<std::mutex> lg(mutex_);
+    Watched watched = {thread, std::chrono::steady_clock::time_point()};
+    watched_.push_back(watched);
+  }
+
+  // Task tracking stays on, the thread may have other observers.
+  void Unwatch(Thread* thread) {
+    std::lock_guard<std::mutex> lg(mutex_);
+    for (size_t i = 0; i < watched_.size(); i++) {
+      if (watched_[i].thread == thread) {
+        watched_.erase(watched_.begin() + i);
+        break;
+      }
+    }
+  }
+
+ private:
+  struct Watched {
+    Thread* thread;
+    // start of the last task reported, a task is reported once
+    std::chrono::steady_clock::time_point reported;
+  };
+
+  void Monitor() {
+    std::unique_lock<std::mutex> ul(mutex_);
+    while (!wakeup_.wait_for(ul, period_, [this] { return exit_; })) {
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      for (Watched& watched : watched_) {
+        std::chrono::steady_clock::time_point start;
+        HangReport report;
+        if (!watched.thread->GetRunningTask(&start, &report.posted_from))
+          continue;
+        if (start == watched.reported || now - start < threshold_)
+          continue;
+        watched.reported = start;
+        report.thread_name = watched.thread->GetThreadName();
+        report.thread_id = watched.thread->GetThreadId();
+        report.running = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start);
+        handler_(report);
+      }
+    }
+  }
+
+  const std::chrono::nanoseconds threshold_;
+  const std::chrono::nanoseconds period_;
+  Handler handler_;
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  bool exit_;
+  std::vector<Watched> watched_;
+  std::thread monitor_;
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(Watchdog);
+};
+}  // namespace akali
+#endif  // AKALI_WATCHDOG_H_
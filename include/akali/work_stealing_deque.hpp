@@ -0,0 +1,153 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#ifndef AKALI_WORK_STEALING_DEQUE_H_
+#define AKALI_WORK_STEALING_DEQUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include "akali/akali_export.h"
+#include "akali/constructormagic.h"
+
+/*
+WorkStealingDeque is the Chase-Lev deque, with the memory orders of "Correct and Efficient
+Work-Stealing for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+
+One thread owns the deque: only it may Push() and Pop(), both at the bottom and without any
+locked instruction except when a single item is left. Any thread may Steal() from the top, a
+steal costs one CAS. The ring buffer doubles when full, the outgrown buffers are kept until the
+deque is destroyed because a thief may still be reading them.
+
+T must be trivially copyable, typically a pointer to a task.
+*/
+
+namespace akali {
+template <typename T>
+class WorkStealingDeque {
+ public:
+  explicit WorkStealingDeque(size_t capacity = 256) : top_(0), bottom_(0) {
+    size_t c = 2;
+    while (c < capacity)
+      c <<= 1;
+    buffers_.push_back(new Buffer(c));
+    buffer_.store(buffers_.back(), std::memory_order_relaxed);
+  }
+
+  ~WorkStealingDeque() {
+    for (Buffer* b : buffers_)
+      delete b;
+  }
+
+  // Owner only.
+  void Push(T item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    if (b - t > static_cast<int64_t>(buffer->capacity) - 1)
+      buffer = Grow(buffer, t, b);
+    buffer->Put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only, takes the most recently pushed item.
+  bool Pop(T* item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    *item = buffer->Get(b);
+    if (t == b) {
+      // Last item, race the thieves for it.
+      bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // Any thread, takes the oldest item. Also fails when another thread won the race for it.
+  bool Steal(T* item) {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b)
+      return false;
+
+    Buffer* buffer = buffer_.load(std::memory_order_acquire);
+    T result = buffer->Get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+      return false;
+    *item = result;
+    return true;
+  }
+
+  // Approximate when other threads are pushing or stealing.
+  size_t Size() const {
+    int64_t b = bottom_.load(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_seq_cst);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+  }
+
+  bool Empty() const { return Size() == 0; }
+
+ private:
+  struct Buffer {
+    explicit Buffer(size_t c) : capacity(c), mask(c - 1), items(new std::atomic<T>[c]) {}
+    ~Buffer() { delete[] items; }
+
+    T Get(int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+    void Put(int64_t i, T item) { items[i & mask].store(item, std::memory_order_relaxed); }
+
+    size_t capacity;
+    int64_t mask;
+    std::atomic<T>* items;
+  };
+
+  Buffer* Grow(Buffer* old, int64_t t, int64_t b) {
+    Buffer* buffer = new Buffer(old->capacity * 2);
+    for (int64_t i = t; i < b; i++)
+      buffer->Put(i, old->Get(i));
+    buffers_.push_back(buffer);
+    buffer_.store(buffer, std::memory_order_release);
+    return buffer;
+  }
+
+  // top_ is written by thieves, bottom_ by the owner, keep them on different cache lines.
+  std::atomic<int64_t> top_;
+  char padding0_[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t> bottom_;
+  char padding1_[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<Buffer*> buffer_;
+  // Owner only.
+  std::vector<Buffer*> buffers_;
+
+  static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable.");
+
+  AKALI_DISALLOW_COPY_AND_ASSIGN(WorkStealingDeque);
+};
+}  // namespace akali
+#endif  // AKALI_WORK_STEALING_DEQUE_H_
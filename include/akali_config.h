@@ -0,0 +1,7 @@
+﻿#ifndef _PPX_CONFIG_H__
+#define _PPX_CONFIG_H__
+#pragma once
+
+
+
+#endif //!_PPX_CONFIG_H__
@@ -0,0 +1,193 @@
+/*******************************************************************************
+ * Copyright (C) 2018 - 2020, winsoft666, <winsoft666@outlook.com>.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Expect bugs
+ *
+ * Please use and enjoy. Please let me know of any bugs/improvements
+ * that you have found/implemented and I will fix/incorporate them into this
+ * file.
+ *******************************************************************************/
+
+#include "akali/cpu_topology.h"
+#include <algorithm>
+#include <map>
+#include <utility>
+#ifdef AKALI_WIN
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined AKALI_LINUX
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#endif
+
+namespace akali {
+#ifdef AKALI_WIN
+std::vector<CpuInfo> GetCpuTopology() {
+  std::vector<CpuInfo> cpus;
+  DWORD_PTR process_mask = 0;
+  DWORD_PTR system_mask = 0;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+    return cpus;
+
+  DWORD length = 0;
+  GetLogicalProcessorInformation(NULL, &length);
+  if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+    return cpus;
+  std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(
+      length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+  if (!GetLogicalProcessorInformation(infos.data(), &length))
+    return cpus;
+
+  const int kBits = static_cast<int>(sizeof(ULONG_PTR) * 8);
+  std::vector<CpuInfo> all(kBits);
+  for (int i = 0; i < kBits; i++) {
+    all[i].cpu = i;
+    all[i].core = -1;
+    all[i].package = 0;
+    all[i].node = 0;
+  }
+
+  int core = 0;
+  int package = 0;
+  for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& info : infos) {
+    for (int i = 0; i < kBits; i++) {
+      if ((info.ProcessorMask & (static_cast<ULONG_PTR>(1) << i)) == 0)
+        continue;
+      if (info.Relationship == RelationProcessorCore)
+        all[i].core = core;
+      else if (info.Relationship == RelationProcessorPackage)
+        all[i].package = package;
+      else if (info.Relationship == RelationNumaNode)
+        all[i].node = static_cast<int>(info.NumaNode.NodeNumber);
+    }
+    if (info.Relationship == RelationProcessorCore)
+      core++;
+    else if (info.Relationship == RelationProcessorPackage)
+      package++;
+  }
+
+  for (int i = 0; i < kBits; i++) {
+    if ((process_mask & (static_cast<DWORD_PTR>(1) << i)) != 0 && all[i].core >= 0)
+      cpus.push_back(all[i]);
+  }
+  return cpus;
+}
+
+bool SetCurrentThreadAffinity(const std::vector<int>& cpus) {
+  const int kBits = static_cast<int>(sizeof(DWORD_PTR) * 8);
+  DWORD_PTR mask = 0;
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < kBits)
+      mask |= static_cast<DWORD_PTR>(1) << cpu;
+  }
+  if (mask == 0)
+    return false;
+  return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+#elif defined AKALI_LINUX
+namespace {
+int ReadSysfsInt(const char* path, int fallback) {
+  FILE* f = fopen(path, "r");
+  if (!f)
+    return fallback;
+  int value = fallback;
+  if (fscanf(f, "%d", &value) != 1)
+    value = fallback;
+  fclose(f);
+  return value;
+}
+
+// cpuN links the node it belongs to as a nodeM entry.
+int NodeOfCpu(int cpu) {
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR* dir = opendir(path);
+  if (!dir)
+    return 0;
+  int node = 0;
+  while (struct dirent* entry = readdir(dir)) {
+    int n = 0;
+    if (strncmp(entry->d_name, "node", 4) == 0 && sscanf(entry->d_name + 4, "%d", &n) == 1) {
+      node = n;
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+}  // namespace
+
+std::vector<CpuInfo> GetCpuTopology() {
+  std::vector<CpuInfo> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    return cpus;
+
+  // core_id is only unique within a package.
+  std::map<std::pair<int, int>, int> cores;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &set))
+      continue;
+    char path[128];
+    CpuInfo info;
+    info.cpu = cpu;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+             cpu);
+    info.package = ReadSysfsInt(path, 0);
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+    int core_id = ReadSysfsInt(path, cpu);
+    int next = static_cast<int>(cores.size());
+    info.core = cores.insert(std::make_pair(std::make_pair(info.package, core_id), next))
+                    .first->second;
+    info.node = NodeOfCpu(cpu);
+    cpus.push_back(info);
+  }
+  return cpus;
+}
+
+bool SetCurrentThreadAffinity(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  }
+  if (CPU_COUNT(&set) == 0)
+    return false;
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+#else
+std::vector<CpuInfo> GetCpuTopology() {
+  return std::vector<CpuInfo>();
+}
+
+bool SetCurrentThreadAffinity(const std::vector<int>&) {
+  return false;
+}
+#endif
+
+std::vector<CpuInfo> GetPhysicalCores() {
+  std::vector<CpuInfo> cores;
+  std::vector<CpuInfo> cpus = GetCpuTopology();
+  for (const CpuInfo& cpu : cpus) {
+    bool seen = false;
+    for (const CpuInfo& core : cores)
+      seen = seen || core.core == cpu.core;
+    if (!seen)
+      cores.push_back(cpu);
+  }
+  std::stable_sort(cores.begin(), cores.end(), [](const CpuInfo& a, const CpuInfo& b) {
+    return a.node != b.node ? a.node < b.node : a.core < b.core;
+  });
+  return cores;
+}
+}  // namespace akali
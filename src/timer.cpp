@@ -13,6 +13,18 @@
 *******************************************************************************/
 
 #include "akali/timer.h"
+#ifdef AKALI_LINUX
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#endif
 
 #ifdef AKALI_WIN
 namespace akali {
@@ -53,4 +65,213 @@ void TimerBase::Stop(bool bWait) {
 
 void TimerBase::OnTimedEvent() {}
 }  // namespace akali
-#endif
\ No newline at end of file
+#endif
+
+#ifdef AKALI_LINUX
+namespace akali {
+namespace internal {
+struct TimerEntry {
+  TimerBase* owner;
+  int fd;
+  uint64_t id;
+  TimerBase::Executor executor;
+  // guarded by TimerService::mutex_
+  bool active;
+  // callbacks handed out and not finished yet
+  int inflight;
+};
+
+namespace {
+// The timer whose callback the calling thread is running, Stop(true) from it must not wait.
+thread_local TimerEntry* current_entry = nullptr;
+
+// One thread waiting on the timerfds of all timers. epoll_event.data holds the timer id rather
+// than the entry, so a timer stopped after epoll_wait() returned is just not found.
+class TimerService {
+ public:
+  // Never destroyed, timers may be stopped from static destructors.
+  static TimerService& Instance() {
+    static TimerService* service = new TimerService();
+    return *service;
+  }
+
+  bool Add(const std::shared_ptr<TimerEntry>& entry,
+           unsigned int interval,
+           bool immediately,
+           bool once) {
+    if (epoll_ < 0)
+      return false;
+    entry->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (entry->fd < 0)
+      return false;
+
+    // a zero it_value disarms the timer, fire "immediately" after 1ns
+    struct itimerspec spec = {};
+    if (!immediately && interval > 0) {
+      spec.it_value.tv_sec = interval / 1000;
+      spec.it_value.tv_nsec = (interval % 1000) * 1000000L;
+    }
+    else {
+      spec.it_value.tv_nsec = 1;
+    }
+    if (!once) {
+      spec.it_interval.tv_sec = interval / 1000;
+      spec.it_interval.tv_nsec = (interval % 1000) * 1000000L;
+    }
+
+    std::lock_guard<std::mutex> lg(mutex_);
+    entry->id = ++last_id_;
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = entry->id;
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, entry->fd, &event) != 0 ||
+        timerfd_settime(entry->fd, 0, &spec, nullptr) != 0) {
+      close(entry->fd);
+      return false;
+    }
+    entry->active = true;
+    entries_[entry->id] = entry;
+    return true;
+  }
+
+  bool IsActive(const std::shared_ptr<TimerEntry>& entry) {
+    std::lock_guard<std::mutex> lg(mutex_);
+    return entry->active;
+  }
+
+  // Idempotent, a callback and the owner's destructor may both stop the timer.
+  void Remove(const std::shared_ptr<TimerEntry>& entry, bool wait) {
+    std::unique_lock<std::mutex> ul(mutex_);
+    if (entry->active) {
+      entry->active = false;
+      epoll_ctl(epoll_, EPOLL_CTL_DEL, entry->fd, nullptr);
+      close(entry->fd);
+      entries_.erase(entry->id);
+    }
+    if (wait && current_entry != entry.get())
+      idle_.wait(ul, [&entry]() { return entry->inflight == 0; });
+  }
+
+ private:
+  TimerService() : epoll_(epoll_create1(EPOLL_CLOEXEC)), last_id_(0) {
+    if (epoll_ >= 0)
+      std::thread(&TimerService::Run, this).detach();
+  }
+
+  void Run() {
+    struct epoll_event events[64];
+    for (;;) {
+      int n = epoll_wait(epoll_, events, 64, -1);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return;
+      }
+      for (int i = 0; i < n; i++)
+        Dispatch(events[i].data.u64);
+    }
+  }
+
+  void Dispatch(uint64_t id) {
+    std::shared_ptr<TimerEntry> entry;
+    {
+      std::lock_guard<std::mutex> lg(mutex_);
+      std::map<uint64_t, std::shared_ptr<TimerEntry>>::iterator it = entries_.find(id);
+      if (it == entries_.end())
+        return;
+      // the fd is only closed under the mutex, reading the expirations rearms epoll
+      uint64_t expirations = 0;
+      if (read(it->second->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+      entry = it->second;
+      entry->inflight += entry->executor ? 2 : 1;
+    }
+
+    if (entry->executor) {
+      // Handing the callback over counts as in flight too, Stop(true) lets the owner destroy the
+      // executor.
+      TimerService* service = this;
+      try {
+        entry->executor([service, entry]() { service->Fire(entry); });
+      } catch (...) {
+        // Rejected, e.g. by a pool that is shut down or full, this tick is dropped. Letting the
+        // exception out would terminate the process.
+        Release(entry);
+      }
+      Release(entry);
+    }
+    else {
+      Fire(entry);
+    }
+  }
+
+  void Fire(const std::shared_ptr<TimerEntry>& entry) {
+    bool active;
+    {
+      std::lock_guard<std::mutex> lg(mutex_);
+      active = entry->active;
+    }
+    if (active) {
+      TimerEntry* outer = current_entry;
+      current_entry = entry.get();
+      entry->owner->OnTimedEvent();
+      current_entry = outer;
+    }
+    Release(entry);
+  }
+
+  void Release(const std::shared_ptr<TimerEntry>& entry) {
+    std::lock_guard<std::mutex> lg(mutex_);
+    if (--entry->inflight == 0)
+      idle_.notify_all();
+  }
+
+  const int epoll_;
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  uint64_t last_id_;
+  std::map<uint64_t, std::shared_ptr<TimerEntry>> entries_;
+};
+}  // namespace
+}  // namespace internal
+
+TimerBase::TimerBase() {}
+
+TimerBase::~TimerBase() {
+  Stop(true);
+}
+
+void TimerBase::SetExecutor(Executor executor) {
+  m_executor = std::move(executor);
+}
+
+bool TimerBase::Start(unsigned int ulInterval, bool bImmediately, bool bOnce) {
+  if (m_entry && internal::TimerService::Instance().IsActive(m_entry))
+    return false;
+
+  std::shared_ptr<internal::TimerEntry> entry = std::make_shared<internal::TimerEntry>();
+  entry->owner = this;
+  entry->fd = -1;
+  entry->id = 0;
+  entry->executor = m_executor;
+  entry->active = false;
+  entry->inflight = 0;
+  // set before the timer is armed, its first callback may already Stop() it
+  m_entry = entry;
+  if (!internal::TimerService::Instance().Add(entry, ulInterval, bImmediately, bOnce)) {
+    m_entry.reset();
+    return false;
+  }
+  return true;
+}
+
+// m_entry stays until the next Start(), so Stop() from a callback doesn't race with a Stop() on
+// the owner's thread, both wait on the same entry.
+void TimerBase::Stop(bool bWait) {
+  if (m_entry)
+    internal::TimerService::Instance().Remove(m_entry, bWait);
+}
+
+void TimerBase::OnTimedEvent() {}
+}  // namespace akali
+#endif
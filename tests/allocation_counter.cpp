@@ -0,0 +1,47 @@
+#include "allocation_counter.h"
+#include <stdlib.h>
+#include <new>
+
+namespace {
+// Plain thread_locals, operator new may run before or after any dynamic initialization.
+thread_local bool counting = false;
+thread_local size_t allocations = 0;
+}  // namespace
+
+// Kept out of the test files so the compiler never sees free() next to a new expression.
+void* operator new(size_t size) {
+  if (counting)
+    allocations++;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+// Every new that the replacement delete may see has to be replaced, e.g. std::stable_sort's
+// temporary buffer comes from the nothrow version.
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  if (counting)
+    allocations++;
+  return malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+ScopedAllocationCounter::ScopedAllocationCounter() : start_(allocations), was_counting_(counting) {
+  counting = true;
+}
+
+ScopedAllocationCounter::~ScopedAllocationCounter() {
+  counting = was_counting_;
+}
+
+size_t ScopedAllocationCounter::count() const {
+  return allocations - start_;
+}
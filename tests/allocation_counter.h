@@ -0,0 +1,21 @@
+#ifndef AKALI_TESTS_ALLOCATION_COUNTER_H_
+#define AKALI_TESTS_ALLOCATION_COUNTER_H_
+
+#include <stddef.h>
+
+// Counts the heap allocations of the calling thread while it is alive, through the replacement
+// operator new in allocation_counter.cpp. Other threads, e.g. pool workers or the timer thread,
+// are not counted.
+class ScopedAllocationCounter {
+ public:
+  ScopedAllocationCounter();
+  ~ScopedAllocationCounter();
+
+  size_t count() const;
+
+ private:
+  size_t start_;
+  bool was_counting_;
+};
+
+#endif  // AKALI_TESTS_ALLOCATION_COUNTER_H_
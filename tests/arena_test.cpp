@@ -0,0 +1,90 @@
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "akali/arena.hpp"
+
+TEST(ArenaTest, Allocate) {
+  akali::Arena arena(1024);
+
+  char* a = static_cast<char*>(arena.Allocate(10, 1));
+  char* b = static_cast<char*>(arena.Allocate(10, 1));
+  EXPECT_EQ(a + 10, b);
+
+  double* d = arena.New<double>(1.5);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(d) % alignof(double), 0u);
+  EXPECT_EQ(*d, 1.5);
+
+  // Larger than a block.
+  char* big = static_cast<char*>(arena.Allocate(10000));
+  memset(big, 1, 10000);
+  EXPECT_EQ(arena.BytesAllocated(), 10u + 10u + sizeof(double) + 10000u);
+
+  for (int i = 0; i < 1000; i++) {
+    int* p = arena.New<int>(i);
+    EXPECT_EQ(*p, i);
+  }
+}
+
+TEST(ArenaTest, MarkRewind) {
+  akali::Arena arena(512);
+  arena.Allocate(100);
+
+  akali::Arena::Marker m = arena.Mark();
+  void* first = arena.Allocate(100);
+  for (int i = 0; i < 100; i++)
+    arena.Allocate(100);
+
+  arena.Rewind(m);
+  EXPECT_EQ(arena.Allocate(100), first);
+
+  {
+    akali::ArenaScope scope(&arena);
+    for (int i = 0; i < 100; i++)
+      arena.Allocate(64);
+  }
+  void* next = arena.Allocate(8, 8);
+  arena.Rewind(m);
+  EXPECT_EQ(arena.Allocate(100), first);
+  EXPECT_NE(next, nullptr);
+
+  arena.Reset();
+  EXPECT_EQ(arena.BytesAllocated(), 0u);
+  arena.Allocate(100);
+  arena.Release();
+}
+
+TEST(ArenaTest, Allocator) {
+  akali::Arena arena;
+  {
+    akali::ArenaAllocator<int> alloc(&arena);
+    std::vector<int, akali::ArenaAllocator<int>> v(alloc);
+    for (int i = 0; i < 1000; i++)
+      v.push_back(i);
+    EXPECT_EQ(v[999], 999);
+
+    typedef std::pair<const int, int> Value;
+    akali::ArenaAllocator<Value> map_alloc(&arena);
+    std::map<int, int, std::less<int>, akali::ArenaAllocator<Value>> m(map_alloc);
+    for (int i = 0; i < 1000; i++)
+      m[i] = i;
+    EXPECT_EQ(m.size(), 1000u);
+  }
+  EXPECT_GT(arena.BytesAllocated(), 1000 * sizeof(int));
+  arena.Reset();
+}
+
+#ifdef AKALI_ARENA_HAS_PMR
+TEST(ArenaTest, MemoryResource) {
+  akali::Arena arena;
+  akali::ArenaMemoryResource resource(&arena);
+  {
+    std::pmr::vector<std::pmr::string> v(&resource);
+    for (int i = 0; i < 100; i++)
+      v.emplace_back("a string long enough to not fit the small buffer");
+    EXPECT_EQ(v.size(), 100u);
+  }
+  EXPECT_GT(arena.BytesAllocated(), 0u);
+}
+#endif
@@ -0,0 +1,126 @@
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "gtest/gtest.h"
+#include "akali/coroutine.hpp"
+
+namespace {
+akali::task<int> Square(akali::ThreadPool& pool, int x, std::thread::id* ran_on) {
+  co_await pool.schedule();
+  *ran_on = std::this_thread::get_id();
+  co_return x * x;
+}
+
+akali::task<std::string> Pipeline(akali::ThreadPool& pool,
+                                  akali::Thread& thread,
+                                  std::thread::id* square_on,
+                                  std::thread::id* sum_on,
+                                  long* thread_id) {
+  int a = co_await Square(pool, 3, square_on);
+  // The awaiting coroutine goes on where the task finished.
+  *sum_on = std::this_thread::get_id();
+  int b = co_await Square(pool, 4, square_on);
+  co_await thread.SwitchTo();
+  *thread_id = akali::Thread::GetCurThreadId();
+  co_return std::to_string(a + b);
+}
+
+akali::task<void> Fail(akali::ThreadPool& pool) {
+  co_await pool.schedule();
+  throw std::runtime_error("boom");
+}
+
+akali::task<int> Catch(akali::ThreadPool& pool) {
+  try {
+    co_await Fail(pool);
+  } catch (const std::runtime_error&) {
+    co_return 1;
+  }
+  co_return 0;
+}
+
+akali::task<int> SwitchAndAnswer(akali::Thread& thread) {
+  co_await thread.SwitchTo();
+  co_return 42;
+}
+}  // namespace
+
+TEST(CoroutineTest, HopsBetweenExecutors) {
+  akali::ThreadPool pool(2);
+  akali::Thread thread("coroutine");
+  ASSERT_TRUE(thread.Start());
+
+  std::thread::id square_on, sum_on;
+  long thread_id = 0;
+  akali::task<std::string> t = Pipeline(pool, thread, &square_on, &sum_on, &thread_id);
+  EXPECT_FALSE(t.is_ready());
+  EXPECT_EQ(akali::sync_wait(std::move(t)), "25");
+  EXPECT_NE(square_on, std::this_thread::get_id());
+  EXPECT_NE(sum_on, std::this_thread::get_id());
+  EXPECT_NE(thread_id, akali::Thread::GetCurThreadId());
+  EXPECT_NE(thread_id, 0);
+  thread.Stop(true);
+}
+
+TEST(CoroutineTest, Exceptions) {
+  akali::ThreadPool pool(1);
+  EXPECT_EQ(akali::sync_wait(Catch(pool)), 1);
+  EXPECT_THROW(akali::sync_wait(Fail(pool)), std::runtime_error);
+
+  std::thread::id ran_on;
+  akali::Future<int> f = akali::to_future(Square(pool, 5, &ran_on));
+  EXPECT_EQ(f.get(), 25);
+}
+
+TEST(CoroutineTest, DroppedHopFailsTheCoroutine) {
+  akali::ThreadPool pool(1);
+  std::promise<void> release;
+  std::shared_future<void> gate = release.get_future().share();
+  std::promise<void> started;
+  pool.post([gate, &started]() {
+    started.set_value();
+    gate.wait();
+  });
+  started.get_future().wait();
+
+  // The hop is queued behind the stuck worker when the pool drops its pending tasks.
+  std::thread::id ran_on;
+  akali::Future<int> f = akali::to_future(Square(pool, 6, &ran_on));
+  std::thread stopper([&pool]() { pool.shutdown(akali::ThreadPoolShutdown::kDiscardPending); });
+  EXPECT_THROW(f.get(), std::future_error);
+  EXPECT_EQ(ran_on, std::thread::id());
+  release.set_value();
+  stopper.join();
+
+  // A rejected hop throws from co_await, the coroutine isn't resumed a second time.
+  akali::ThreadPoolOptions options;
+  options.min_threads = 1;
+  options.queue_capacity = 1;
+  options.overflow = akali::ThreadPoolOverflow::kReject;
+  akali::ThreadPool bounded(options);
+  std::promise<void> unblock;
+  std::shared_future<void> wall = unblock.get_future().share();
+  std::promise<void> blocked;
+  bounded.post([wall, &blocked]() {
+    blocked.set_value();
+    wall.wait();
+  });
+  blocked.get_future().wait();
+  bounded.post([]() {});
+  EXPECT_THROW(akali::sync_wait(Square(bounded, 7, &ran_on)), std::runtime_error);
+  unblock.set_value();
+
+  // Same for a Thread destroyed with the hop still queued.
+  akali::Future<int> g;
+  {
+    akali::Thread thread("never started");
+    g = akali::to_future(SwitchAndAnswer(thread));
+    EXPECT_FALSE(g.is_ready());
+  }
+  EXPECT_THROW(g.get(), std::future_error);
+}
+#endif
+#endif
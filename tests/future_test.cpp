@@ -0,0 +1,86 @@
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "akali/future.hpp"
+#include "akali/thread.hpp"
+#include "akali/thread_pool.hpp"
+
+TEST(FutureTest, ThenChains) {
+  akali::Future<std::string> f = akali::make_ready_future(2)
+                                     .then([](int x) { return x * 3; })
+                                     .then([](int x) { return std::to_string(x); });
+  EXPECT_TRUE(f.is_ready());
+  EXPECT_EQ(f.get(), "6");
+  EXPECT_FALSE(f.valid());
+
+  int calls = 0;
+  akali::Promise<void> promise;
+  akali::Future<int> g = promise.get_future().then([&calls]() { return ++calls; });
+  EXPECT_EQ(calls, 0);
+  promise.set_value();
+  EXPECT_EQ(g.get(), 1);
+}
+
+TEST(FutureTest, ExceptionsSkipContinuations) {
+  int calls = 0;
+  akali::Future<int> f = akali::make_ready_future(1)
+                             .then([](int) -> int { throw std::runtime_error("boom"); })
+                             .then([&calls](int x) { return x + ++calls; });
+  EXPECT_THROW(f.get(), std::runtime_error);
+  EXPECT_EQ(calls, 0);
+
+  akali::Future<void> broken;
+  {
+    akali::Promise<void> promise;
+    broken = promise.get_future();
+  }
+  EXPECT_THROW(broken.get(), std::future_error);
+}
+
+TEST(FutureTest, PipelineOnPool) {
+  // A single worker runs every stage, nothing waits in get() on the pool.
+  akali::ThreadPool pool(1);
+  std::vector<akali::Future<size_t>> hashes;
+  for (int i = 0; i < 50; i++) {
+    hashes.push_back(pool.async([i]() { return std::string(i, 'a'); })
+                         .then_on(pool, [](std::string s) { return s + "!"; })
+                         .then_on(pool, [](std::string s) { return std::hash<std::string>()(s); }));
+  }
+  akali::Future<std::vector<akali::Future<size_t>>> all = akali::when_all(std::move(hashes));
+  std::vector<akali::Future<size_t>> done = all.get();
+  ASSERT_EQ(done.size(), 50u);
+  for (int i = 0; i < 50; i++)
+    EXPECT_EQ(done[i].get(), std::hash<std::string>()(std::string(i, 'a') + "!"));
+
+  akali::Thread thread("continuation");
+  ASSERT_TRUE(thread.Start());
+  long id = pool.async([]() {})
+                .then_on(thread, []() { return akali::Thread::GetCurThreadId(); })
+                .get();
+  EXPECT_NE(id, akali::Thread::GetCurThreadId());
+  thread.Stop(true);
+}
+
+TEST(FutureTest, WhenAny) {
+  std::vector<akali::Promise<int>> promises(3);
+  std::vector<akali::Future<int>> futures;
+  for (akali::Promise<int>& p : promises)
+    futures.push_back(p.get_future());
+  akali::Future<akali::WhenAnyResult<int>> any = akali::when_any(std::move(futures));
+  EXPECT_FALSE(any.is_ready());
+
+  std::thread setter([&promises]() { promises[1].set_value(7); });
+  akali::WhenAnyResult<int> result = any.get();
+  setter.join();
+  EXPECT_EQ(result.index, 1u);
+  EXPECT_EQ(result.futures[1].get(), 7);
+  promises[0].set_value(0);
+  promises[2].set_value(2);
+  EXPECT_EQ(result.futures[2].get(), 2);
+
+  EXPECT_EQ(akali::when_all(std::vector<akali::Future<int>>()).get().size(), 0u);
+}
@@ -0,0 +1,514 @@
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "akali/memory_pool.hpp"
+#include "akali/concurrent_memory_pool.hpp"
+#include "akali/lockfree_memory_pool.hpp"
+
+namespace {
+struct Node {
+  Node(int a, const std::string& b) : x(a), s(b) {}
+  int x;
+  std::string s;
+};
+}  // namespace
+
+TEST(MemoryPoolTest, SlotsShareBlocks) {
+  akali::MemoryPool<int64_t> pool;
+
+  std::vector<int64_t*> v;
+  for (int i = 0; i < 16; i++) {
+    int64_t* p = pool.allocate();
+    *p = i;
+    v.push_back(p);
+  }
+
+  // Consecutive fresh slots come from the bump pointer of the same block.
+  for (size_t i = 1; i < v.size(); i++) {
+    EXPECT_EQ(v[i - 1] + 1, v[i]);
+  }
+
+  for (size_t i = 0; i < v.size(); i++) {
+    EXPECT_EQ(*v[i], (int64_t)i);
+  }
+
+  // Released slots are reused LIFO.
+  pool.deallocate(v[3]);
+  pool.deallocate(v[7]);
+  EXPECT_EQ(pool.allocate(), v[7]);
+  EXPECT_EQ(pool.allocate(), v[3]);
+}
+
+TEST(MemoryPoolTest, ManyBlocks) {
+  akali::MemoryPool<Node, 256> pool;
+
+  std::vector<Node*> v;
+  for (int i = 0; i < 10000; i++) {
+    v.push_back(pool.newElement(i, std::to_string(i)));
+  }
+
+  std::set<Node*> uniq(v.begin(), v.end());
+  EXPECT_EQ(uniq.size(), v.size());
+
+  for (int i = 0; i < 10000; i++) {
+    EXPECT_EQ(v[i]->x, i);
+    EXPECT_EQ(v[i]->s, std::to_string(i));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(v[i]) % alignof(Node), 0u);
+  }
+
+  for (size_t i = 0; i < v.size(); i += 2) {
+    pool.deleteElement(v[i]);
+  }
+  for (size_t i = 0; i < v.size(); i += 2) {
+    v[i] = pool.newElement(-1, "");
+  }
+  for (size_t i = 1; i < v.size(); i += 2) {
+    EXPECT_EQ(v[i]->x, (int)i);
+  }
+  for (Node* p : v) {
+    pool.deleteElement(p);
+  }
+}
+
+TEST(MemoryPoolTest, StdContainers) {
+  std::list<int, akali::MemoryPool<int>> l;
+  for (int i = 0; i < 1000; i++) {
+    l.push_back(i);
+  }
+  int expect = 0;
+  for (int x : l) {
+    EXPECT_EQ(x, expect++);
+  }
+
+  std::map<int, std::string, std::less<int>,
+           akali::MemoryPool<std::pair<const int, std::string>>>
+      m;
+  for (int i = 0; i < 1000; i++) {
+    m[i] = std::to_string(i);
+  }
+  for (int i = 0; i < 1000; i += 3) {
+    m.erase(i);
+  }
+  EXPECT_EQ(m.size(), 666u);
+  EXPECT_EQ(m[1], "1");
+
+  // Array allocations are forwarded to the global heap.
+  std::vector<int, akali::MemoryPool<int>> vec;
+  for (int i = 0; i < 1000; i++) {
+    vec.push_back(i);
+  }
+  EXPECT_EQ(vec[999], 999);
+}
+
+TEST(ConcurrentMemoryPoolTest, CrossThreadFree) {
+  typedef akali::ConcurrentMemoryPool<Node, 4096, 16> Pool;
+  Pool pool;
+
+  const int kThreads = 4;
+  const int kCount = 20000;
+  std::vector<std::vector<Node*>> produced(kThreads);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&pool, &produced, t]() {
+      for (int i = 0; i < kCount; i++) {
+        produced[t].push_back(pool.newElement(t * kCount + i, ""));
+      }
+    });
+  }
+  for (std::thread& t : threads)
+    t.join();
+  threads.clear();
+
+  std::set<Node*> uniq;
+  for (int t = 0; t < kThreads; t++) {
+    for (int i = 0; i < kCount; i++) {
+      EXPECT_EQ(produced[t][i]->x, t * kCount + i);
+      uniq.insert(produced[t][i]);
+    }
+  }
+  EXPECT_EQ(uniq.size(), (size_t)kThreads * kCount);
+
+  // Free everything on a thread other than the one that allocated it, then reuse.
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&pool, &produced, t]() {
+      for (Node* p : produced[(t + 1) % kThreads]) {
+        pool.deleteElement(p);
+      }
+      for (int i = 0; i < kCount; i++) {
+        pool.deleteElement(pool.newElement(i, "x"));
+      }
+    });
+  }
+  for (std::thread& t : threads)
+    t.join();
+
+  // Slots released by exited threads are served again.
+  std::set<Node*> again;
+  for (int i = 0; i < kThreads * kCount; i++) {
+    Node* p = pool.newElement(i, "");
+    EXPECT_TRUE(uniq.count(p) == 1);
+    again.insert(p);
+  }
+  EXPECT_EQ(again.size(), (size_t)kThreads * kCount);
+  for (Node* p : again)
+    pool.deleteElement(p);
+}
+
+TEST(ConcurrentMemoryPoolTest, StdContainers) {
+  akali::ConcurrentMemoryPool<int> pool;
+  std::list<int, akali::ConcurrentMemoryPool<int>> l(pool);
+  std::thread t([&l]() {
+    for (int i = 0; i < 1000; i++) {
+      l.push_back(i);
+    }
+  });
+  t.join();
+
+  int expect = 0;
+  for (int x : l) {
+    EXPECT_EQ(x, expect++);
+  }
+  l.clear();
+}
+
+// The pools propagate on container move and swap, so they have to move their memory along.
+template <class Pool>
+class PoolMoveTest : public ::testing::Test {};
+
+typedef ::testing::Types<akali::ConcurrentMemoryPool<int>, akali::LockFreeMemoryPool<int>>
+    MovablePools;
+TYPED_TEST_CASE(PoolMoveTest, MovablePools);
+
+TYPED_TEST(PoolMoveTest, ContainerMoveAndSwap) {
+  typedef std::list<int, TypeParam> List;
+  List a;
+  List b;
+  for (int i = 0; i < 1000; i++) {
+    a.push_back(i);
+    b.push_back(-i);
+  }
+
+  // The pool moves with the list, its nodes stay valid after the source is gone.
+  List c;
+  {
+    List source(std::move(a));
+    c = std::move(source);
+  }
+  c.swap(b);
+  std::swap(a, c);
+  ASSERT_EQ(a.size(), 1000u);
+  ASSERT_EQ(b.size(), 1000u);
+  int expect = 0;
+  for (int x : b)
+    EXPECT_EQ(x, expect++);
+  expect = 0;
+  for (int x : a)
+    EXPECT_EQ(x, -expect++);
+  b.push_back(1000);
+  EXPECT_EQ(b.back(), 1000);
+}
+
+TEST(LockFreeMemoryPoolTest, ProducersConsumers) {
+  // The free list link overlays the first bytes of a released slot, keep the marker after it.
+  struct Item {
+    int producer;
+    int seq;
+    std::atomic<int> live;
+  };
+  const int kLive = 0x5A5A5A5A;
+  akali::LockFreeMemoryPool<Item, 1024> pool;
+
+  const int kProducers = 4;
+  const int kConsumers = 4;
+  const int kCount = 50000;
+
+  std::mutex queue_mutex;
+  std::deque<Item*> queue;
+  std::atomic<int> consumed(0);
+  std::atomic<int> errors(0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kProducers; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < kCount; i++) {
+        Item* item = pool.allocate();
+        // A slot handed out twice would already be marked live.
+        if (item->live.exchange(kLive) == kLive)
+          errors++;
+        item->producer = t;
+        item->seq = i;
+
+        // Churn the free list from the producer side as well.
+        pool.deallocate(pool.allocate());
+
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(item);
+      }
+    });
+  }
+
+  for (int t = 0; t < kConsumers; t++) {
+    threads.emplace_back([&]() {
+      std::vector<int> last_seq(kProducers, -1);
+      while (consumed.load() < kProducers * kCount) {
+        Item* item = nullptr;
+        {
+          std::lock_guard<std::mutex> lock(queue_mutex);
+          if (!queue.empty()) {
+            item = queue.front();
+            queue.pop_front();
+          }
+        }
+        if (!item) {
+          std::this_thread::yield();
+          continue;
+        }
+        if (item->producer < 0 || item->producer >= kProducers ||
+            item->seq <= last_seq[item->producer]) {
+          errors++;
+        }
+        else {
+          last_seq[item->producer] = item->seq;
+        }
+        item->live.store(0);
+        pool.deallocate(item);
+        consumed++;
+      }
+    });
+  }
+
+  for (std::thread& t : threads)
+    t.join();
+
+  EXPECT_EQ(errors.load(), 0);
+  EXPECT_EQ(consumed.load(), kProducers * kCount);
+}
+
+TEST(LockFreeMemoryPoolTest, Reserve) {
+  akali::LockFreeMemoryPool<int64_t, 4096> pool;
+  pool.Reserve(2000);
+
+  std::set<int64_t*> uniq;
+  for (int i = 0; i < 2000; i++) {
+    uniq.insert(pool.allocate());
+  }
+  EXPECT_EQ(uniq.size(), 2000u);
+  for (int64_t* p : uniq)
+    pool.deallocate(p);
+}
+
+TEST(MemoryPoolTest, Trim) {
+  typedef akali::MemoryPool<int64_t, 1024> Pool;
+  Pool pool;
+
+  std::vector<int64_t*> v;
+  for (int i = 0; i < 10000; i++)
+    v.push_back(pool.allocate());
+
+  akali::MemoryPoolCounters c = pool.Counters();
+  size_t peak_blocks = c.blocks_held;
+  EXPECT_GT(peak_blocks, 70u);
+  EXPECT_EQ(c.bytes_held, peak_blocks * 1024);
+
+  // Nothing to give back while every block has a live object.
+  for (size_t i = 0; i < v.size(); i += 2)
+    pool.deallocate(v[i]);
+  EXPECT_EQ(pool.Trim(), 0u);
+  EXPECT_EQ(pool.Counters().free_slots, 5000u);
+
+  for (size_t i = 1; i < v.size(); i += 2) {
+    if (i < 9000)
+      pool.deallocate(v[i]);
+  }
+  size_t released = pool.Trim();
+  c = pool.Counters();
+  EXPECT_GT(released, 0u);
+  EXPECT_EQ(c.trims, 1u);
+  EXPECT_EQ(c.blocks_released * 1024, released);
+  EXPECT_EQ(c.blocks_held, peak_blocks - c.blocks_released);
+  EXPECT_LT(c.blocks_held, peak_blocks / 5);
+  // Smaller than a page, the blocks went back to the heap.
+  EXPECT_EQ(c.bytes_freed, released);
+  EXPECT_EQ(c.bytes_unmapped, 0u);
+
+  // Survivors are untouched and the remaining free slots are still served.
+  for (size_t i = 9001; i < v.size(); i += 2)
+    *v[i] = static_cast<int64_t>(i);
+  for (size_t i = 0; i < c.free_slots; i++)
+    pool.allocate();
+  for (size_t i = 9001; i < v.size(); i += 2)
+    EXPECT_EQ(*v[i], static_cast<int64_t>(i));
+}
+
+TEST(MemoryPoolTest, TrimUnmapsPageBlocks) {
+  akali::MemoryPool<int64_t, 4096> pool;
+
+  std::vector<int64_t*> v;
+  for (int i = 0; i < 10000; i++) {
+    int64_t* p = pool.allocate();
+    *p = i;
+    v.push_back(p);
+  }
+  for (int64_t* p : v)
+    pool.deallocate(p);
+
+  size_t released = pool.Trim();
+  akali::MemoryPoolCounters c = pool.Counters();
+  EXPECT_GT(released, 0u);
+  EXPECT_EQ(c.bytes_released, released);
+  EXPECT_EQ(c.bytes_freed, 0u);
+  // One mapping per block, at least BlockSize once rounded to the page size.
+  EXPECT_GE(c.bytes_unmapped, released);
+  EXPECT_EQ(c.bytes_unmapped % c.blocks_released, 0u);
+}
+
+TEST(MemoryPoolTest, TrimThresholdAndHugePages) {
+  typedef akali::MemoryPool<int64_t, 2 * 1024 * 1024> Pool;
+  Pool pool;
+  pool.EnableHugePages(true);
+  pool.SetTrimThreshold(1);
+
+  std::vector<int64_t*> v;
+  for (int i = 0; i < 1000000; i++) {
+    int64_t* p = pool.allocate();
+    *p = i;
+    v.push_back(p);
+  }
+  size_t peak_blocks = pool.Counters().blocks_held;
+  EXPECT_GE(peak_blocks, 3u);
+
+  for (int64_t* p : v)
+    pool.deallocate(p);
+
+  akali::MemoryPoolCounters c = pool.Counters();
+  EXPECT_GT(c.blocks_released, 0u);
+  EXPECT_EQ(c.blocks_held, peak_blocks - c.blocks_released);
+  EXPECT_LE(c.huge_page_blocks, peak_blocks);
+}
+
+namespace {
+struct Secret {
+  char bytes[96];
+};
+
+template <class Scrub>
+bool ScrubbedOnFree() {
+  akali::MemoryPool<Secret, 4096, Scrub> pool;
+  Secret* s = pool.allocate();
+  memset(s->bytes, 0x5A, sizeof(s->bytes));
+  pool.deallocate(s);
+  // The free list link overlays the first bytes.
+  for (size_t i = sizeof(void*); i < sizeof(s->bytes); i++) {
+    if (s->bytes[i] != 0)
+      return false;
+  }
+  return true;
+}
+}  // namespace
+
+TEST(MemoryPoolTest, Scrub) {
+  EXPECT_FALSE(ScrubbedOnFree<akali::ScrubNone>());
+  EXPECT_TRUE(ScrubbedOnFree<akali::ScrubObject>());
+  EXPECT_TRUE(ScrubbedOnFree<akali::ScrubNonTemporal>());
+  EXPECT_FALSE(ScrubbedOnFree<akali::ScrubDeferred>());
+  EXPECT_TRUE(ScrubbedOnFree<akali::ScrubIf<true>>());
+  EXPECT_FALSE(ScrubbedOnFree<akali::ScrubIf<false>>());
+
+  akali::MemoryPool<Secret, 4096, akali::ScrubDeferred> pool;
+  std::vector<Secret*> v;
+  for (size_t i = 0; i < akali::ScrubDeferred::kBatchSize; i++) {
+    Secret* s = pool.allocate();
+    memset(s->bytes, 0x5A, sizeof(s->bytes));
+    v.push_back(s);
+  }
+  for (size_t i = 0; i + 1 < v.size(); i++)
+    pool.deallocate(v[i]);
+  EXPECT_EQ(v[0]->bytes[sizeof(void*)], 0x5A);
+  EXPECT_EQ(pool.Counters().free_slots, v.size() - 1);
+
+  // The batch is scrubbed once it is full.
+  pool.deallocate(v.back());
+  for (Secret* s : v)
+    EXPECT_EQ(s->bytes[sizeof(s->bytes) - 1], 0);
+
+  // Pending slots are scrubbed before they are reused.
+  for (size_t i = 0; i < v.size(); i++)
+    v[i] = pool.allocate();
+  Secret* s = v.back();
+  memset(s->bytes, 0x5A, sizeof(s->bytes));
+  pool.deallocate(s);
+  EXPECT_EQ(pool.allocate(), s);
+  EXPECT_EQ(s->bytes[sizeof(s->bytes) - 1], 0);
+
+  s->bytes[50] = 1;
+  pool.deallocate(s);
+  pool.ScrubPending();
+  EXPECT_EQ(s->bytes[50], 0);
+}
+
+namespace {
+std::vector<const void*> reported_leaks;
+
+struct RecordLeaks : akali::PoolStats {
+  void OnLeaks(const void*, const std::vector<const void*>& objects, size_t) {
+    reported_leaks = objects;
+  }
+};
+}  // namespace
+
+TEST(MemoryPoolTest, Stats) {
+  static_assert(sizeof(akali::MemoryPool<int, 4096>) <
+                    sizeof(akali::MemoryPool<int, 4096, akali::ScrubNone, akali::PoolStats>),
+                "NoPoolStats should not count anything");
+
+  akali::MemoryPool<Secret, 4096> plain;
+  plain.deallocate(plain.allocate());
+  akali::MemoryPoolStats s = plain.Snapshot();
+  EXPECT_EQ(s.allocations, 0u);
+  EXPECT_EQ(s.blocks_held, 1u);
+  EXPECT_EQ(s.free_slots, 1u);
+
+  std::vector<Secret*> leaked;
+  {
+    akali::MemoryPool<Secret, 4096, akali::ScrubNone, RecordLeaks> pool;
+    akali::MemoryPoolStats before = pool.Snapshot();
+
+    std::vector<Secret*> v;
+    for (int i = 0; i < 100; i++)
+      v.push_back(pool.allocate());
+    for (int i = 0; i < 100; i++) {
+      if (i % 10 == 0)
+        leaked.push_back(v[i]);
+      else
+        pool.deallocate(v[i]);
+    }
+
+    akali::MemoryPoolStats after = pool.Snapshot();
+    EXPECT_EQ(after.allocations, 100u);
+    EXPECT_EQ(after.deallocations, 90u);
+    EXPECT_EQ(after.live_objects, 10u);
+    EXPECT_EQ(after.peak_live_objects, 100u);
+    EXPECT_EQ(after.free_slots, 90u);
+    EXPECT_GT(after.blocks_held, 1u);
+    EXPECT_EQ(after.bytes_held, after.blocks_held * 4096);
+    EXPECT_GE(after.padding_bytes, after.blocks_held * sizeof(void*));
+    EXPECT_LT(after.padding_bytes, after.blocks_held * (sizeof(Secret) + 2 * sizeof(void*)));
+    EXPECT_GE(akali::AllocationRate(before, after), 0);
+
+    std::vector<const Secret*> live = pool.LiveObjects();
+    EXPECT_EQ(live.size(), leaked.size());
+  }
+  std::sort(leaked.begin(), leaked.end());
+  std::sort(reported_leaks.begin(), reported_leaks.end());
+  EXPECT_EQ(reported_leaks, std::vector<const void*>(leaked.begin(), leaked.end()));
+}
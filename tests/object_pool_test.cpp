@@ -0,0 +1,102 @@
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "akali/object_pool.hpp"
+
+namespace {
+struct Context {
+  Context() : id(0) { constructed++; }
+  explicit Context(int i) : id(i) { constructed++; }
+  ~Context() { destroyed++; }
+
+  void Reset() {
+    id = 0;
+    buffer.clear();
+    name.clear();
+    resets++;
+  }
+
+  int id;
+  std::vector<char> buffer;
+  std::string name;
+
+  static int constructed;
+  static int destroyed;
+  static int resets;
+};
+int Context::constructed = 0;
+int Context::destroyed = 0;
+int Context::resets = 0;
+}  // namespace
+
+TEST(ObjectPoolTest, Recycle) {
+  Context::constructed = Context::destroyed = Context::resets = 0;
+  {
+    akali::ObjectPool<Context> pool(2);
+
+    Context* raw = nullptr;
+    {
+      akali::PooledPtr<Context> c = pool.Acquire(7);
+      EXPECT_EQ(c->id, 7);
+      c->buffer.resize(64 * 1024);
+      c->name.assign(1000, 'x');
+      raw = c.get();
+      EXPECT_EQ(pool.LiveCount(), 1u);
+    }
+    EXPECT_EQ(pool.LiveCount(), 0u);
+    EXPECT_EQ(pool.IdleCount(), 1u);
+    EXPECT_EQ(Context::resets, 1);
+    EXPECT_EQ(Context::destroyed, 0);
+
+    // Reused object, reset but with its grown capacity.
+    akali::PooledPtr<Context> c = pool.Acquire(9);
+    EXPECT_EQ(c.get(), raw);
+    EXPECT_EQ(c->id, 0);
+    EXPECT_TRUE(c->buffer.empty());
+    EXPECT_GE(c->buffer.capacity(), 64u * 1024);
+    EXPECT_GE(c->name.capacity(), 1000u);
+    EXPECT_EQ(Context::constructed, 1);
+
+    // Handles move, only the last owner gives the object back.
+    akali::PooledPtr<Context> moved(std::move(c));
+    EXPECT_FALSE(c);
+    EXPECT_TRUE(moved);
+    moved.reset();
+    EXPECT_EQ(pool.IdleCount(), 1u);
+
+    // Idle objects above the cap are destroyed.
+    std::vector<akali::PooledPtr<Context>> v;
+    for (int i = 0; i < 5; i++)
+      v.push_back(pool.Acquire(i));
+    EXPECT_EQ(pool.LiveCount(), 5u);
+    v.clear();
+    EXPECT_EQ(pool.IdleCount(), 2u);
+    EXPECT_EQ(Context::destroyed, 3);
+  }
+  EXPECT_EQ(Context::constructed, Context::destroyed);
+}
+
+TEST(ObjectPoolTest, ResetHook) {
+  akali::ObjectPool<std::string> pool;
+
+  // No Reset() and no hook: objects can't be recycled.
+  pool.Acquire("abc").reset();
+  EXPECT_EQ(pool.IdleCount(), 0u);
+
+  pool.SetResetHook([](std::string& s) { s.clear(); });
+  std::string* raw = nullptr;
+  {
+    akali::PooledPtr<std::string> s = pool.Acquire();
+    s->assign(500, 'a');
+    raw = s.get();
+  }
+  EXPECT_EQ(pool.IdleCount(), 1u);
+  akali::PooledPtr<std::string> s = pool.Acquire();
+  EXPECT_EQ(s.get(), raw);
+  EXPECT_TRUE(s->empty());
+  EXPECT_GE(s->capacity(), 500u);
+
+  pool.SetMaxIdle(0);
+  s.reset();
+  EXPECT_EQ(pool.IdleCount(), 0u);
+}
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "akali/parallel_algorithm.hpp"
+#include "akali/thread_pool.hpp"
+
+namespace {
+std::vector<int> RandomInts(size_t n, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> dist(-1000, 1000);
+  std::vector<int> v(n);
+  for (int& x : v)
+    x = dist(rng);
+  return v;
+}
+}  // namespace
+
+class ParallelAlgorithmTest : public ::testing::TestWithParam<size_t> {};
+
+TEST_P(ParallelAlgorithmTest, MatchesStd) {
+  akali::ThreadPool pool(3, akali::ThreadPoolMode::kWorkStealing);
+  size_t n = GetParam();
+  std::vector<int> in = RandomInts(n, static_cast<unsigned>(n));
+
+  std::vector<int> sorted = in;
+  akali::parallel::sort(pool, sorted.begin(), sorted.end());
+  std::vector<int> expected = in;
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(sorted, expected);
+
+  std::vector<int> descending = in;
+  akali::parallel::sort(pool, descending.begin(), descending.end(), std::greater<int>());
+  EXPECT_TRUE(std::is_sorted(descending.begin(), descending.end(), std::greater<int>()));
+
+  std::vector<long> squares(n);
+  akali::parallel::transform(pool, in.begin(), in.end(), squares.begin(),
+                             [](int x) { return static_cast<long>(x) * x; });
+  EXPECT_EQ(akali::parallel::reduce(pool, squares.begin(), squares.end(), 0L),
+            std::accumulate(squares.begin(), squares.end(), 0L));
+
+  std::vector<long> scan(n);
+  std::vector<long> expected_scan(n);
+  akali::parallel::inclusive_scan(pool, squares.begin(), squares.end(), scan.begin());
+  std::partial_sum(squares.begin(), squares.end(), expected_scan.begin());
+  EXPECT_EQ(scan, expected_scan);
+
+  std::vector<int> evens(n);
+  auto even = [](int x) { return x % 2 == 0; };
+  evens.erase(akali::parallel::copy_if(pool, in.begin(), in.end(), evens.begin(), even),
+              evens.end());
+  std::vector<int> expected_evens;
+  std::copy_if(in.begin(), in.end(), std::back_inserter(expected_evens), even);
+  EXPECT_EQ(evens, expected_evens);
+
+  auto big = [](int x) { return x > 990; };
+  EXPECT_EQ(akali::parallel::find_if(pool, in.begin(), in.end(), big),
+            std::find_if(in.begin(), in.end(), big));
+  EXPECT_EQ(akali::parallel::find_if(pool, in.begin(), in.end(), [](int x) { return x > 5000; }),
+            in.end());
+
+  std::vector<int> counted(n, 0);
+  akali::parallel::for_each(pool, counted.begin(), counted.end(), [](int& x) { x++; });
+  EXPECT_EQ(std::count(counted.begin(), counted.end(), 1), static_cast<long>(n));
+}
+
+INSTANTIATE_TEST_CASE_P(Sizes,
+                        ParallelAlgorithmTest,
+                        ::testing::Values(size_t(0), size_t(1000), size_t(100003), size_t(1) << 20));
+
+TEST(ParallelAlgorithmTest, SortsStringsWithoutWorkers) {
+  akali::ThreadPool pool(0);
+  std::vector<std::string> words;
+  for (int i = 0; i < 100000; i++)
+    words.push_back(std::to_string((i * 7919) % 100000));
+  akali::parallel::sort(pool, words.begin(), words.end());
+  EXPECT_TRUE(std::is_sorted(words.begin(), words.end()));
+  EXPECT_EQ(words.size(), 100000u);
+}
@@ -0,0 +1,81 @@
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "akali/size_class_pool.hpp"
+
+TEST(SizeClassPoolTest, Classes) {
+  EXPECT_EQ(akali::SizeClassPool::AllocationSize(0), 16u);
+  EXPECT_EQ(akali::SizeClassPool::AllocationSize(1), 16u);
+  EXPECT_EQ(akali::SizeClassPool::AllocationSize(17), 32u);
+  EXPECT_EQ(akali::SizeClassPool::AllocationSize(128), 128u);
+  EXPECT_EQ(akali::SizeClassPool::AllocationSize(129), 160u);
+  EXPECT_EQ(akali::SizeClassPool::AllocationSize(161), 192u);
+  EXPECT_EQ(akali::SizeClassPool::AllocationSize(256), 256u);
+  EXPECT_EQ(akali::SizeClassPool::AllocationSize(257), 320u);
+  EXPECT_EQ(akali::SizeClassPool::AllocationSize(1000), 1024u);
+  EXPECT_EQ(akali::SizeClassPool::AllocationSize(akali::SizeClassPool::kMaxSmallSize),
+            akali::SizeClassPool::kMaxSmallSize);
+  EXPECT_EQ(akali::SizeClassPool::ClassIndex(akali::SizeClassPool::kMaxSmallSize),
+            akali::SizeClassPool::kClassCount - 1);
+
+  // Every size fits its class and classes grow monotonically.
+  size_t last = 0;
+  for (size_t size = 1; size <= akali::SizeClassPool::kMaxSmallSize; size++) {
+    size_t index = akali::SizeClassPool::ClassIndex(size);
+    size_t class_size = akali::SizeClassPool::ClassSize(index);
+    EXPECT_GE(class_size, size);
+    EXPECT_GE(class_size, last);
+    EXPECT_EQ(class_size % akali::SizeClassPool::kAlignment, 0u);
+    last = class_size;
+  }
+}
+
+TEST(SizeClassPoolTest, AllocateDeallocate) {
+  akali::SizeClassPool pool;
+
+  std::vector<std::pair<char*, size_t>> v;
+  for (size_t size = 1; size < 300000; size = size * 3 / 2 + 1) {
+    char* p = static_cast<char*>(pool.Allocate(size));
+    ASSERT_TRUE(p != nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % akali::SizeClassPool::kAlignment, 0u);
+    memset(p, static_cast<int>(size & 0xFF), size);
+    v.push_back(std::make_pair(p, size));
+  }
+
+  for (auto& e : v) {
+    EXPECT_EQ(e.first[0], static_cast<char>(e.second & 0xFF));
+    EXPECT_EQ(e.first[e.second - 1], static_cast<char>(e.second & 0xFF));
+  }
+
+  // Released slots are reused by requests of the same class.
+  void* p = pool.Allocate(100);
+  pool.Deallocate(p, 100);
+  EXPECT_EQ(pool.Allocate(112), p);
+
+  for (auto& e : v)
+    pool.Deallocate(e.first, e.second);
+}
+
+TEST(SizeClassPoolTest, Allocator) {
+  typedef std::basic_string<char, std::char_traits<char>, akali::SizeClassAllocator<char>>
+      PooledString;
+
+  std::vector<char, akali::SizeClassAllocator<char>> buf;
+  for (int i = 0; i < 200000; i++)
+    buf.push_back(static_cast<char>(i));
+  EXPECT_EQ(buf[199999], static_cast<char>(199999));
+
+  PooledString s;
+  for (int i = 0; i < 1000; i++)
+    s += "0123456789";
+  EXPECT_EQ(s.size(), 10000u);
+
+  akali::SizeClassPool pool;
+  akali::SizeClassAllocator<int> a(&pool);
+  std::vector<int, akali::SizeClassAllocator<int>> ints(a);
+  ints.assign(5000, 7);
+  EXPECT_EQ(ints.get_allocator(), a);
+  EXPECT_NE(ints.get_allocator(), akali::SizeClassAllocator<int>());
+}
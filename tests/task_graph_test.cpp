@@ -0,0 +1,116 @@
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "akali/task_graph.hpp"
+#include "akali/thread_pool.hpp"
+
+TEST(TaskGraphTest, RunsInDependencyOrder) {
+  akali::ThreadPool pool(4, akali::ThreadPoolMode::kWorkStealing);
+  std::mutex mutex;
+  std::vector<std::string> order;
+  auto record = [&](const char* name) {
+    return [&, name]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(name);
+    };
+  };
+
+  // a -> (b, c) -> d
+  akali::TaskGraph graph("diamond");
+  akali::TaskGraphNode& a = graph.emplace(record("a"), "a");
+  akali::TaskGraphNode& b = graph.emplace(record("b"), "b");
+  akali::TaskGraphNode& c = graph.emplace(record("c"), "c");
+  akali::TaskGraphNode& d = graph.emplace(record("d"), "d");
+  a.precede(b).precede(c);
+  d.succeed(b).succeed(c);
+
+  for (int run = 0; run < 100; run++) {
+    order.clear();
+    graph.run(pool).get();
+    ASSERT_EQ(order.size(), 4u);
+    EXPECT_EQ(order.front(), "a");
+    EXPECT_EQ(order.back(), "d");
+  }
+
+  std::string dot = graph.dot();
+  EXPECT_NE(dot.find("digraph \"diamond\""), std::string::npos);
+  EXPECT_NE(dot.find("n0 -> n1;"), std::string::npos);
+  EXPECT_NE(dot.find("n2 -> n3;"), std::string::npos);
+  EXPECT_NE(dot.find(" us\"]"), std::string::npos);
+}
+
+TEST(TaskGraphTest, WideGraphAndReuse) {
+  akali::ThreadPool pool(3);
+  std::atomic<int> count(0);
+  akali::TaskGraph graph;
+  akali::TaskGraphNode& root = graph.emplace([]() {});
+  akali::TaskGraphNode& sink = graph.emplace([&count]() { EXPECT_EQ(count, 1000); });
+  for (int i = 0; i < 1000; i++)
+    graph.emplace([&count]() { count++; }).succeed(root).precede(sink);
+
+  for (int run = 1; run <= 5; run++) {
+    count = 0;
+    graph.run(pool).get();
+    EXPECT_EQ(count, 1000);
+  }
+  EXPECT_EQ(akali::TaskGraph().run(pool).is_ready(), true);
+}
+
+TEST(TaskGraphTest, ErrorsAndCycles) {
+  akali::ThreadPool pool(2);
+  bool after = false;
+  akali::TaskGraph graph;
+  graph.emplace([]() { throw std::runtime_error("boom"); })
+      .precede(graph.emplace([&after]() { after = true; }));
+  EXPECT_THROW(graph.run(pool).get(), std::runtime_error);
+  EXPECT_FALSE(after);
+
+  akali::TaskGraph cyclic;
+  akali::TaskGraphNode& x = cyclic.emplace([]() {});
+  akali::TaskGraphNode& y = cyclic.emplace([]() {});
+  x.precede(y);
+  y.precede(x);
+  EXPECT_THROW(cyclic.run(pool), std::logic_error);
+}
+
+TEST(TaskGraphTest, RejectedRunRollsBack) {
+  akali::ThreadPoolOptions options;
+  options.min_threads = 1;
+  options.queue_capacity = 4;
+  options.overflow = akali::ThreadPoolOverflow::kReject;
+  akali::ThreadPool pool(options);
+
+  std::atomic<int> count(0);
+  akali::TaskGraph graph;
+  for (int i = 0; i < 64; i++)
+    graph.emplace([&count]() { count++; });
+
+  // The worker is stuck and the queue holds a task, so the 64 sources don't fit.
+  std::promise<void> release;
+  std::shared_future<void> gate = release.get_future().share();
+  std::promise<void> started;
+  std::future<void> stuck = pool.enqueue([gate, &started]() {
+    started.set_value();
+    gate.wait();
+  });
+  started.get_future().wait();
+  std::future<void> queued = pool.enqueue([]() {});
+  EXPECT_THROW(graph.run(pool), std::runtime_error);
+
+  release.set_value();
+  stuck.get();
+  queued.get();
+  EXPECT_EQ(count, 0);
+  graph.run(pool).get();
+  EXPECT_EQ(count, 64);
+
+  // Not left running either, the second attempt fails the same way.
+  pool.shutdown();
+  EXPECT_THROW(graph.run(pool), std::runtime_error);
+  EXPECT_THROW(graph.run(pool), std::runtime_error);
+  EXPECT_EQ(count, 64);
+}
@@ -0,0 +1,82 @@
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include "gtest/gtest.h"
+#include "allocation_counter.h"
+#include "akali/task.hpp"
+#include "akali/thread.hpp"
+#include "akali/thread_pool.hpp"
+
+TEST(TaskTest, InlineAndHeapTargets) {
+  int calls = 0;
+  std::array<char, 2 * akali::Task::kInlineSize> big = {};
+  akali::Task small;
+  akali::Task large;
+  {
+    ScopedAllocationCounter allocations;
+    small = akali::Task([&calls]() { calls++; });
+    EXPECT_EQ(allocations.count(), 0u);
+    large = akali::Task([&calls, big]() { calls += 1 + big[0]; });
+    EXPECT_EQ(allocations.count(), 1u);
+  }
+
+  akali::Task moved(std::move(small));
+  EXPECT_FALSE(small);
+  moved();
+  large = std::move(moved);
+  large();
+  EXPECT_EQ(calls, 2);
+}
+
+TEST(TaskTest, MoveOnlyTarget) {
+  std::unique_ptr<int> value(new int(41));
+  int result = 0;
+  akali::Task task(std::bind([&result](std::unique_ptr<int>& v) { result = *v + 1; },
+                             std::move(value)));
+  akali::Task other(std::move(task));
+  other();
+  EXPECT_EQ(result, 42);
+}
+
+TEST(TaskTest, FutureTask) {
+  std::future<std::string> f;
+  akali::Task task = akali::MakeFutureTask(&f, [](int n) { return std::string(n, 'x'); }, 3);
+  task();
+  EXPECT_EQ(f.get(), "xxx");
+
+  std::future<void> g;
+  task = akali::MakeFutureTask(&g, []() { throw std::runtime_error("boom"); });
+  task();
+  EXPECT_THROW(g.get(), std::runtime_error);
+}
+
+TEST(TaskTest, PostAllocatesNothing) {
+  const int kTasks = 1000;
+  std::atomic<int> done(0);
+  akali::ThreadPool pool(2, akali::ThreadPoolMode::kWorkStealing);
+
+  // The first rounds warm up the node pool and the thread caches. Later the node pool may still
+  // add a magazine now and then, but posting allocates nothing per task.
+  for (int round = 0; round < 4; round++) {
+    ScopedAllocationCounter allocations;
+    done = 0;
+    for (int i = 0; i < kTasks; i++)
+      pool.post([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+    if (round == 3) {
+      EXPECT_LT(allocations.count(), size_t(kTasks / 100));
+    }
+    while (done != kTasks)
+      std::this_thread::yield();
+  }
+}
+
+TEST(TaskTest, ThreadPost) {
+  akali::Thread t("post");
+  ASSERT_TRUE(t.Start());
+  std::atomic<int> sum(0);
+  t.Post([&sum](int a, int b) { sum += a + b; }, 1, 2);
+  EXPECT_EQ(t.Invoke([&sum]() { return sum.load(); }).get(), 3);
+  t.Stop(true);
+}
@@ -0,0 +1,425 @@
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "akali/thread_pool.hpp"
+#include "akali/work_stealing_deque.hpp"
+#ifdef AKALI_LINUX
+#include <sched.h>
+#include <sys/prctl.h>
+#endif
+
+TEST(WorkStealingDequeTest, OwnerAndThieves) {
+  const int kCount = 100000;
+  akali::WorkStealingDeque<int*> deque(4);
+  std::vector<int> items(kCount);
+  std::vector<std::atomic<int>> seen(kCount);
+  for (auto& s : seen)
+    s = 0;
+
+  std::atomic<bool> done(false);
+  std::vector<std::thread> thieves;
+  for (int t = 0; t < 3; t++) {
+    thieves.emplace_back([&]() {
+      int* p = nullptr;
+      while (!done) {
+        if (deque.Steal(&p))
+          seen[p - items.data()]++;
+      }
+    });
+  }
+
+  // Push in bursts so that the buffer grows while thieves are active.
+  int* p = nullptr;
+  for (int i = 0; i < kCount; i++) {
+    deque.Push(&items[i]);
+    if (i % 3 == 0 && deque.Pop(&p))
+      seen[p - items.data()]++;
+  }
+  while (deque.Pop(&p))
+    seen[p - items.data()]++;
+  done = true;
+  for (std::thread& t : thieves)
+    t.join();
+
+  for (int i = 0; i < kCount; i++)
+    ASSERT_EQ(seen[i], 1) << i;
+}
+
+class ThreadPoolTest : public ::testing::TestWithParam<akali::ThreadPoolMode> {};
+
+TEST_P(ThreadPoolTest, Results) {
+  akali::ThreadPool pool(4, GetParam());
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < 1000; i++)
+    results.push_back(pool.enqueue([](int x) { return x * x; }, i));
+  for (int i = 0; i < 1000; i++)
+    EXPECT_EQ(results[i].get(), i * i);
+}
+
+TEST_P(ThreadPoolTest, TasksSpawnTasks) {
+  std::atomic<int> count(0);
+  {
+    akali::ThreadPool pool(4, GetParam());
+    std::vector<std::thread> feeders;
+    for (int f = 0; f < 2; f++) {
+      feeders.emplace_back([&]() {
+        for (int i = 0; i < 100; i++) {
+          pool.enqueue([&]() {
+            for (int j = 0; j < 50; j++)
+              pool.enqueue([&]() { count++; });
+          });
+        }
+      });
+    }
+    for (std::thread& t : feeders)
+      t.join();
+    // The destructor runs everything that was enqueued.
+  }
+  EXPECT_EQ(count, 2 * 100 * 50);
+}
+
+TEST_P(ThreadPoolTest, Exceptions) {
+  akali::ThreadPool pool(2, GetParam());
+  auto f = pool.enqueue([]() -> int { throw std::runtime_error("boom"); });
+  EXPECT_THROW(f.get(), std::runtime_error);
+  EXPECT_EQ(pool.enqueue([]() { return 7; }).get(), 7);
+}
+
+INSTANTIATE_TEST_CASE_P(Modes,
+                        ThreadPoolTest,
+                        ::testing::Values(akali::ThreadPoolMode::kSharedQueue,
+                                          akali::ThreadPoolMode::kWorkStealing));
+
+TEST_P(ThreadPoolTest, EnqueueBulk) {
+  std::atomic<int> sum(0);
+  {
+    akali::ThreadPool pool(3, GetParam());
+    std::vector<std::function<void()>> batch;
+    for (int i = 1; i <= 100; i++)
+      batch.push_back([&sum, i]() { sum += i; });
+    pool.enqueue_bulk(batch.begin(), batch.end());
+    pool.enqueue_bulk(batch.begin(), batch.begin());
+  }
+  EXPECT_EQ(sum, 5050);
+}
+
+TEST_P(ThreadPoolTest, ParallelFor) {
+  akali::ThreadPool pool(3, GetParam());
+  std::vector<std::atomic<int>> hits(10007);
+  for (auto& h : hits)
+    h = 0;
+  pool.parallel_for(size_t(0), hits.size(), size_t(16), [&hits](size_t i) { hits[i]++; });
+  for (size_t i = 0; i < hits.size(); i++)
+    ASSERT_EQ(hits[i], 1) << i;
+
+  // Nested loops run on workers, the outer callers take part in the inner loops.
+  std::atomic<long> total(0);
+  pool.parallel_for(0, 8, 1, [&](int) {
+    pool.parallel_for(0, 1000, 10, [&](int j) { total += j; });
+  });
+  EXPECT_EQ(total, 8 * 999 * 1000 / 2);
+
+  EXPECT_THROW(pool.parallel_for(0, 1000, 1,
+                                 [](int i) {
+                                   if (i == 500)
+                                     throw std::runtime_error("boom");
+                                 }),
+               std::runtime_error);
+}
+
+TEST_P(ThreadPoolTest, ParallelReduce) {
+  akali::ThreadPool pool(3, GetParam());
+  long sum = pool.parallel_reduce(
+      1L, 100001L, 64L, 0L,
+      [](long b, long e, long acc) {
+        for (long i = b; i < e; i++)
+          acc += i;
+        return acc;
+      },
+      [](long a, long b) { return a + b; });
+  EXPECT_EQ(sum, 100000L * 100001L / 2);
+
+  akali::ThreadPool none(0, GetParam());
+  EXPECT_EQ(none.parallel_reduce(0, 10, 1, 0, [](int b, int e, int acc) { return acc + e - b; },
+                                 [](int a, int b) { return a + b; }),
+            10);
+}
+
+TEST(ThreadPoolPriorityTest, LanesDeadlinesAndAging) {
+  akali::ThreadPool pool(1);
+  std::mutex mutex;
+  std::vector<std::string> order;
+  auto record = [&](std::string name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(name);
+  };
+
+  // Hold the only worker while the queue fills up.
+  std::promise<void> release;
+  std::shared_future<void> gate = release.get_future().share();
+  auto blocker = pool.enqueue([gate]() { gate.wait(); });
+  while (pool.lane_stats(akali::TaskPriority::kNormal).dequeued == 0)
+    std::this_thread::yield();
+
+  auto now = std::chrono::steady_clock::now();
+  for (int i = 0; i < 20; i++)
+    pool.enqueue_with_priority(akali::TaskPriority::kLow, record, "low");
+  pool.enqueue(record, "normal");
+  pool.enqueue_with_priority(akali::TaskPriority::kHigh, record, "high");
+  pool.enqueue_with_deadline(akali::TaskPriority::kHigh, now + std::chrono::hours(2), record,
+                             "high+2h");
+  pool.enqueue_with_deadline(akali::TaskPriority::kHigh, now + std::chrono::hours(1), record,
+                             "high+1h");
+  for (int i = 0; i < 10; i++)
+    pool.enqueue_with_priority(akali::TaskPriority::kHigh, record, "high");
+
+  akali::ThreadPoolLaneStats low = pool.lane_stats(akali::TaskPriority::kLow);
+  EXPECT_EQ(low.depth, 20u);
+  EXPECT_EQ(low.max_depth, 20u);
+
+  release.set_value();
+  auto last = pool.enqueue_with_priority(akali::TaskPriority::kLow, []() {});
+  last.get();
+
+  ASSERT_EQ(order.size(), 34u);
+  EXPECT_EQ(order[0], "high+1h");
+  EXPECT_EQ(order[1], "high+2h");
+  // The low lane is served by aging before the high lane drains.
+  size_t first_low = std::find(order.begin(), order.end(), "low") - order.begin();
+  size_t last_high = std::find(order.rbegin(), order.rend(), "high").base() - order.begin();
+  EXPECT_LT(first_low, last_high);
+  EXPECT_GT(pool.lane_stats(akali::TaskPriority::kLow).aged, 0u);
+  EXPECT_EQ(pool.lane_stats(akali::TaskPriority::kHigh).deadline_misses, 0u);
+  EXPECT_EQ(pool.lane_stats(akali::TaskPriority::kLow).depth, 0u);
+}
+
+TEST(ThreadPoolElasticTest, GrowsAndShrinks) {
+  akali::ThreadPool pool(1, 4);
+  pool.set_grow_latency(std::chrono::milliseconds(1));
+  pool.set_idle_timeout(std::chrono::milliseconds(50));
+  EXPECT_EQ(pool.size(), 1u);
+
+  // Workers block on the gate, the tasks behind them wait and the pool grows.
+  std::promise<void> release;
+  std::shared_future<void> gate = release.get_future().share();
+  std::vector<std::future<void>> blocked;
+  for (int i = 0; i < 500 && pool.size() < 4; i++) {
+    blocked.push_back(pool.enqueue([gate]() { gate.wait(); }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  EXPECT_EQ(pool.size(), 4u);
+  for (int i = 0; i < 5; i++) {
+    blocked.push_back(pool.enqueue([gate]() { gate.wait(); }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  EXPECT_EQ(pool.size(), 4u);
+
+  release.set_value();
+  for (std::future<void>& f : blocked)
+    f.get();
+
+  // Idle workers retire down to the minimum.
+  auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (pool.size() > 1 && std::chrono::steady_clock::now() < give_up)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(pool.size(), 1u);
+  EXPECT_EQ(pool.enqueue([]() { return 5; }).get(), 5);
+}
+
+TEST(ThreadPoolElasticTest, StartsFirstWorkerAtOnce) {
+  akali::ThreadPool pool(0, 4);
+  EXPECT_EQ(pool.size(), 0u);
+  EXPECT_EQ(pool.enqueue([]() { return 1; }).get(), 1);
+  EXPECT_GE(pool.size(), 1u);
+  pool.shutdown();
+}
+
+TEST(ThreadPoolElasticTest, GrowsWithoutFurtherSubmissions) {
+  akali::ThreadPool pool(1, 4);
+  pool.set_grow_latency(std::chrono::milliseconds(10));
+
+  std::promise<void> release;
+  std::shared_future<void> gate = release.get_future().share();
+  std::promise<void> started;
+  std::future<void> stuck = pool.enqueue([gate, &started]() {
+    started.set_value();
+    gate.wait();
+  });
+  started.get_future().wait();
+
+  // Nothing is submitted after this task, the pool has to grow on its own to run it.
+  auto start = std::chrono::steady_clock::now();
+  std::future<void> next = pool.enqueue([]() {});
+  EXPECT_EQ(next.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+  EXPECT_EQ(pool.size(), 2u);
+
+  release.set_value();
+  stuck.get();
+}
+
+#ifdef AKALI_LINUX
+TEST(ThreadPoolOptionsTest, NamesAndPinsWorkers) {
+  std::vector<akali::CpuInfo> cpus = akali::GetCpuTopology();
+  ASSERT_FALSE(cpus.empty());
+  std::vector<akali::CpuInfo> cores = akali::GetPhysicalCores();
+  EXPECT_LE(cores.size(), cpus.size());
+
+  akali::ThreadPoolOptions options;
+  options.min_threads = 2;
+  options.name_prefix = "pool-";
+  options.affinity = akali::ThreadPoolAffinity::kCpuSet;
+  options.cpus.push_back(cpus.back().cpu);
+  options.numa_groups = true;
+  akali::ThreadPool pool(options);
+
+  auto probe = []() {
+    char name[16] = {};
+    prctl(PR_GET_NAME, name);
+    return std::make_pair(std::string(name), sched_getcpu());
+  };
+  std::pair<std::string, int> local = pool.enqueue_on_node(cpus.back().node, probe).get();
+  EXPECT_EQ(local.first.substr(0, 5), "pool-");
+  EXPECT_EQ(local.second, cpus.back().cpu);
+  // The pool has no group for this node, the task runs as a normal one.
+  EXPECT_EQ(pool.enqueue_on_node(1000, probe).get().second, cpus.back().cpu);
+
+  akali::ThreadPoolOptions per_core;
+  per_core.affinity = akali::ThreadPoolAffinity::kPhysicalCores;
+  akali::ThreadPool core_pool(per_core);
+  EXPECT_EQ(core_pool.size(), cores.size());
+}
+#endif
+
+TEST(ThreadPoolStatsTest, CountsAndHistograms) {
+  akali::ThreadPoolOptions options;
+  options.min_threads = 2;
+  options.mode = akali::ThreadPoolMode::kWorkStealing;
+  options.collect_stats = true;
+  akali::ThreadPool pool(options);
+
+  // Queue behind a blocked pool so the depth builds up.
+  std::promise<void> release;
+  std::shared_future<void> gate = release.get_future().share();
+  std::vector<std::future<void>> done;
+  for (int i = 0; i < 2; i++)
+    done.push_back(pool.enqueue([gate]() { gate.wait(); }));
+  for (int i = 0; i < 100; i++) {
+    done.push_back(
+        pool.enqueue([]() { std::this_thread::sleep_for(std::chrono::microseconds(50)); }));
+  }
+  EXPECT_GE(pool.stats().queue_depth, 98u);
+  release.set_value();
+  for (std::future<void>& f : done)
+    f.get();
+
+  // A task is counted after it returned, which may be after its future became ready.
+  akali::ThreadPoolStats stats = pool.stats();
+  auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (stats.tasks < 102 && std::chrono::steady_clock::now() < give_up) {
+    std::this_thread::yield();
+    stats = pool.stats();
+  }
+  EXPECT_EQ(stats.workers, 2u);
+  EXPECT_EQ(stats.queue_depth, 0u);
+  EXPECT_GE(stats.peak_queue_depth, 98u);
+  EXPECT_EQ(stats.tasks, 102u);
+  EXPECT_GT(stats.busy.count(), 0);
+  EXPECT_GT(stats.busy_ratio(), 0.0);
+  EXPECT_LE(stats.busy_ratio(), 1.0);
+  uint64_t waits = 0;
+  uint64_t runs = 0;
+  for (size_t i = 0; i < akali::ThreadPoolStats::kBuckets; i++) {
+    waits += stats.wait_histogram[i];
+    runs += stats.run_histogram[i];
+  }
+  EXPECT_EQ(waits, stats.tasks);
+  EXPECT_EQ(runs, stats.tasks);
+  // The sleeping tasks take at least 50us.
+  EXPECT_GE(akali::ThreadPoolStats::percentile(stats.run_histogram, 0.99).count(), 50000);
+  EXPECT_LE(akali::ThreadPoolStats::percentile(stats.run_histogram, 0.0),
+            akali::ThreadPoolStats::percentile(stats.run_histogram, 1.0));
+
+  akali::ThreadPool plain(1);
+  plain.enqueue([]() {}).get();
+  EXPECT_EQ(plain.stats().tasks, 0u);
+}
+
+TEST(ThreadPoolBoundedTest, BlocksRejectsAndTries) {
+  akali::ThreadPoolOptions options;
+  options.min_threads = 1;
+  options.queue_capacity = 4;
+  akali::ThreadPool pool(options);
+
+  std::promise<void> release;
+  std::shared_future<void> gate = release.get_future().share();
+  auto blocker = pool.enqueue([gate]() { gate.wait(); });
+  while (pool.lane_stats(akali::TaskPriority::kNormal).dequeued == 0)
+    std::this_thread::yield();
+
+  std::atomic<int> ran(0);
+  for (int i = 0; i < 4; i++)
+    EXPECT_TRUE(pool.try_post([&ran]() { ran++; }));
+  EXPECT_FALSE(pool.try_post([&ran]() { ran++; }));
+  EXPECT_FALSE(pool.try_enqueue([]() { return 1; }).valid());
+
+  // The producer blocks until the worker makes room.
+  std::atomic<bool> queued(false);
+  std::thread producer([&]() {
+    pool.post([&ran]() { ran++; });
+    queued = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(queued);
+  release.set_value();
+  producer.join();
+  EXPECT_TRUE(queued);
+  EXPECT_EQ(pool.enqueue([]() { return 2; }).get(), 2);
+  EXPECT_EQ(ran, 5);
+
+  akali::ThreadPoolOptions rejecting;
+  rejecting.queue_capacity = 1;
+  rejecting.overflow = akali::ThreadPoolOverflow::kReject;
+  akali::ThreadPool idle(rejecting);
+  idle.post([]() {});
+  EXPECT_THROW(idle.post([]() {}), std::runtime_error);
+  idle.shutdown(akali::ThreadPoolShutdown::kDiscardPending);
+}
+
+TEST(ThreadPoolShutdownTest, DiscardPendingCancels) {
+  akali::ThreadPool pool(1);
+  akali::CancellationToken token = pool.token();
+  std::atomic<bool> started(false);
+  std::atomic<int> ran(0);
+  auto running = pool.enqueue([&]() {
+    started = true;
+    while (!token.is_cancelled())
+      std::this_thread::yield();
+    return 1;
+  });
+  while (!started)
+    std::this_thread::yield();
+  std::vector<std::future<void>> queued;
+  for (int i = 0; i < 10; i++)
+    queued.push_back(pool.enqueue([&ran]() { ran++; }));
+
+  pool.shutdown(akali::ThreadPoolShutdown::kDiscardPending);
+  EXPECT_TRUE(token.is_cancelled());
+  EXPECT_EQ(running.get(), 1);
+  EXPECT_EQ(ran, 0);
+  for (std::future<void>& f : queued)
+    EXPECT_THROW(f.get(), std::future_error);
+  EXPECT_THROW(pool.post([]() {}), std::runtime_error);
+
+  akali::CancellationSource source;
+  akali::CancellationToken copy = source.token();
+  EXPECT_FALSE(copy.is_cancelled());
+  source.cancel();
+  EXPECT_THROW(copy.throw_if_cancelled(), akali::OperationCancelled);
+  EXPECT_FALSE(akali::CancellationToken().is_cancelled());
+}
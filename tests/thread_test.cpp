@@ -1,6 +1,16 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 #include "gtest/gtest.h"
+#include "akali/mpsc_queue.hpp"
 #include "akali/thread.hpp"
+#include "akali/watchdog.hpp"
 
 TEST(ThreadTest, test1) {
   long call_tid = akali::Thread::GetCurThreadId();
@@ -36,4 +46,138 @@ TEST(ThreadTest, test1) {
   t.Stop(true);
 
   EXPECT_FALSE(t.IsRunning());
-}
\ No newline at end of file
+}
+TEST(ThreadTest, DelayedAndRepeatingTasks) {
+  akali::Thread t("timers");
+  ASSERT_TRUE(t.Start());
+
+  std::mutex mutex;
+  std::vector<int> order;
+  auto record = [&mutex, &order](int i) {
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(i);
+  };
+  auto start = std::chrono::steady_clock::now();
+  t.PostDelayedTask(std::chrono::milliseconds(60), [record]() { record(3); });
+  t.PostDelayedTask(std::chrono::milliseconds(20), [record]() { record(1); });
+  akali::Thread::DelayedTaskId cancelled =
+      t.PostDelayedTask(std::chrono::milliseconds(40), [record]() { record(2); });
+  t.Post([record]() { record(0); });
+  EXPECT_TRUE(t.CancelDelayedTask(cancelled));
+  EXPECT_FALSE(t.CancelDelayedTask(cancelled));
+
+  std::atomic<int> ticks(0);
+  akali::Thread::DelayedTaskId repeating =
+      t.PostRepeatingTask(std::chrono::milliseconds(5), [&ticks]() { ticks++; });
+
+  // The delayed tasks don't hold the thread up.
+  EXPECT_EQ(t.Invoke([]() { return 7; }).get(), 7);
+  if (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(60)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(std::count(order.begin(), order.end(), 3), 0);
+  }
+
+  std::promise<void> done;
+  t.PostDelayedTask(std::chrono::milliseconds(80), [&done]() { done.set_value(); });
+  done.get_future().wait();
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(80));
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(order, std::vector<int>({0, 1, 3}));
+  }
+
+  EXPECT_TRUE(t.CancelDelayedTask(repeating));
+  int seen = t.Invoke([&ticks]() { return ticks.load(); }).get();
+  EXPECT_GE(seen, 3);
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_EQ(ticks, seen);
+  EXPECT_FALSE(t.CancelDelayedTask(repeating));
+  t.Stop(true);
+}
+
+TEST(MpscQueueTest, ManyProducers) {
+  const int kProducers = 4;
+  const int kCount = 50000;
+  akali::MpscQueue<std::pair<int, int>> queue;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; p++) {
+    producers.emplace_back([&queue, p]() {
+      for (int i = 0; i < kCount; i++)
+        queue.Push(std::make_pair(p, i));
+    });
+  }
+
+  // Every producer's items come out in the order it pushed them.
+  std::vector<int> next(kProducers, 0);
+  int popped = 0;
+  std::pair<int, int> item;
+  while (popped < kProducers * kCount) {
+    if (!queue.Pop(&item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_EQ(item.second, next[item.first]++);
+    popped++;
+  }
+  for (std::thread& t : producers)
+    t.join();
+  EXPECT_TRUE(queue.Empty());
+  EXPECT_FALSE(queue.Pop(&item));
+}
+
+TEST(ThreadTest, PostFromManyThreads) {
+  akali::Thread t("consumer");
+  ASSERT_TRUE(t.Start());
+  long count = 0;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < 4; p++) {
+    producers.emplace_back([&t, &count]() {
+      for (int i = 0; i < 20000; i++)
+        t.Post([&count]() { count++; });
+    });
+  }
+  for (std::thread& p : producers)
+    p.join();
+  // Tasks run one at a time on the thread, in the order they were posted.
+  EXPECT_EQ(t.Invoke([&count]() { return count; }).get(), 80000);
+  t.Stop(true);
+}
+
+TEST(WatchdogTest, ReportsHungTask) {
+  akali::Thread t("watched");
+  ASSERT_TRUE(t.Start());
+
+  std::mutex mutex;
+  std::vector<akali::HangReport> reports;
+  akali::Watchdog watchdog(std::chrono::milliseconds(50), std::chrono::milliseconds(10),
+                           [&](const akali::HangReport& report) {
+                             std::lock_guard<std::mutex> lg(mutex);
+                             reports.push_back(report);
+                           });
+  watchdog.Watch(&t);
+
+  int line = __LINE__ + 1;
+  std::future<void> hung = t.InvokeFrom(AKALI_FROM_HERE, []() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  });
+  hung.get();
+  t.Invoke([]() {}).get();
+  watchdog.Unwatch(&t);
+
+  std::lock_guard<std::mutex> lg(mutex);
+  // once per task, however long it hangs
+  ASSERT_EQ(reports.size(), 1u);
+  EXPECT_EQ(reports[0].thread_name, "watched");
+  EXPECT_EQ(reports[0].posted_from.line_number(), line);
+  EXPECT_NE(std::string(reports[0].posted_from.file_name()).find("thread_test"),
+            std::string::npos);
+  EXPECT_GE(reports[0].running, std::chrono::milliseconds(50));
+
+  akali::ThreadTaskStats stats = t.GetTaskStats();
+  // the hung task is counted before the next one starts
+  EXPECT_GE(stats.tasks, 1u);
+  EXPECT_GE(stats.longest, std::chrono::milliseconds(300));
+  EXPECT_GE(stats.Percentile(1.0), stats.longest);
+  EXPECT_GE(stats.busy, stats.longest);
+  t.Stop(true);
+}
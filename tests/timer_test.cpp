@@ -0,0 +1,107 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "gtest/gtest.h"
+#include "akali/thread.hpp"
+#include "akali/timer.h"
+
+#if defined AKALI_WIN || defined AKALI_LINUX
+namespace {
+bool WaitFor(const std::function<bool()>& done) {
+  for (int i = 0; i < 400 && !done(); i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  return done();
+}
+}  // namespace
+
+TEST(TimerTest, RepeatingAndOnce) {
+  std::atomic<int> ticks(0);
+  akali::Timer repeating([&ticks]() { ticks++; });
+  ASSERT_TRUE(repeating.Start(10, true, false));
+  EXPECT_FALSE(repeating.Start(10, true, false));
+  EXPECT_TRUE(WaitFor([&ticks]() { return ticks >= 3; }));
+  repeating.Stop(true);
+  int stopped_at = ticks;
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(ticks, stopped_at);
+
+  std::atomic<int> once(0);
+  akali::Timer single([&once]() { once++; });
+  ASSERT_TRUE(single.Start(5, false, true));
+  EXPECT_TRUE(WaitFor([&once]() { return once == 1; }));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(once, 1);
+  single.Stop(true);
+}
+#endif
+
+#ifdef AKALI_LINUX
+TEST(TimerTest, ManyTimersOnAnExecutor) {
+  akali::Thread executor("timer-callbacks");
+  ASSERT_TRUE(executor.Start());
+  long executor_id = executor.Invoke([]() { return akali::Thread::GetCurThreadId(); }).get();
+
+  const int kTimers = 200;
+  std::atomic<int> ticks(0);
+  std::atomic<int> wrong_thread(0);
+  std::vector<std::unique_ptr<akali::Timer>> timers;
+  for (int i = 0; i < kTimers; i++) {
+    timers.emplace_back(new akali::Timer([&]() {
+      if (akali::Thread::GetCurThreadId() != executor_id)
+        wrong_thread++;
+      ticks++;
+    }));
+    timers.back()->SetExecutor(
+        [&executor](std::function<void()> f) { executor.Post(std::move(f)); });
+    ASSERT_TRUE(timers.back()->Start(5, true, false));
+  }
+  EXPECT_TRUE(WaitFor([&ticks]() { return ticks >= 3 * kTimers; }));
+  for (std::unique_ptr<akali::Timer>& timer : timers)
+    timer->Stop(true);
+  int stopped_at = ticks;
+  executor.Invoke([]() {}).get();
+  EXPECT_EQ(ticks, stopped_at);
+  EXPECT_EQ(wrong_thread, 0);
+  executor.Stop(true);
+}
+
+TEST(TimerTest, RejectingExecutor) {
+  std::atomic<int> rejected(0);
+  std::atomic<int> ticks(0);
+  akali::Timer timer([&ticks]() { ticks++; });
+  timer.SetExecutor([&rejected](std::function<void()>) {
+    rejected++;
+    throw std::runtime_error("queue full");
+  });
+  ASSERT_TRUE(timer.Start(1, true, false));
+  EXPECT_TRUE(WaitFor([&rejected]() { return rejected >= 3; }));
+  // the rejected ticks are not left in flight
+  timer.Stop(true);
+  EXPECT_EQ(ticks, 0);
+
+  // and the shared timer thread survived
+  std::atomic<int> other(0);
+  akali::Timer next([&other]() { other++; });
+  ASSERT_TRUE(next.Start(1, true, true));
+  EXPECT_TRUE(WaitFor([&other]() { return other == 1; }));
+  next.Stop(true);
+}
+
+TEST(TimerTest, StopFromOwnCallback) {
+  std::atomic<int> ticks(0);
+  akali::Timer timer;
+  timer.SetTimedEvent([&]() {
+    ticks++;
+    timer.Stop(true);
+  });
+  ASSERT_TRUE(timer.Start(1, true, false));
+  EXPECT_TRUE(WaitFor([&ticks]() { return ticks > 0; }));
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_EQ(ticks, 1);
+}
+#endif